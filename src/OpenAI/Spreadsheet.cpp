@@ -1,10 +1,16 @@
 #include <shared_mutex>
 #include <algorithm> // For std::sort and std::find
+#include <array>
+#include <atomic>
+#include <bit>
 #include <bitset>    // For bit manipulation
 #include <cassert>   // For assertions
 #include <chrono>    // For timing
+#include <condition_variable>
+#include <cctype>
 #include <cmath>     // For mathematical functions
 #include <cstdint>
+#include <cstring>
 #include <ctime> // For time functions
 #include <deque>
 #include <exception>
@@ -14,6 +20,7 @@
 #include <iomanip>
 #include <iostream> // For std::cout and std::cin
 #include <limits>   // For numeric limits
+#include <memory>
 #include <map>      // For std::map and multimap
 #include <mutex>    // For mutexes
 #include <optional>
@@ -23,11 +30,18 @@
 #include <sstream>
 #include <stdexcept>
 #include <string> // For std::string
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <type_traits>
+#include <unistd.h>
 #include <system_error>
 #include <thread> // For multithreading
 #include <unordered_map>
 #include <unordered_set>
+#include <tuple>
 #include <utility> // For std::pair
 #include <variant>
 #include <vector> // For std::vector
@@ -54,6 +68,43 @@ using namespace std;
  *    - We propagate the updates efficiently using a BFS mechanism to all
  * dependent cells.
  *
+ * Part 3: Batched Recalculation in Topological Order
+ *    - SetCells applies many edits, then recomputes each affected formula
+ * exactly once in topological order of the dirty set.
+ *
+ * Part 4: Parallel Recalculation
+ *    - The dirty set is split into topological levels; wide levels are
+ * evaluated concurrently on a fixed worker pool (SetRecalcThreads).
+ *
+ * Part 5: Incremental Cycle Detection
+ *    - A topological order is maintained across edits, so a formula edit only
+ * searches the cells ordered between its endpoints (Pearce-Kelly).
+ *
+ * Part 6: Compiled Formulas
+ *    - Formulas support + - * /, parentheses, constants and SUM(A1:B9). They
+ * are compiled once to bytecode for a small stack machine.
+ *
+ * Part 7: Range Dependencies
+ *    - A SUM rectangle is one dependency node holding the cached sum; changed
+ * cells push deltas into the ranges covering them.
+ *
+ * Part 8: Lazy Evaluation
+ *    - SetLazy(true) turns writes into dirty-bit marking; GetCell2 recomputes
+ * only the stale cells it needs and memoizes them.
+ *
+ * Part 9: Sparse Grid and Sheet Files
+ *    - Cells are stored in 64x64 tiles allocated on demand. SaveSheet writes
+ * the tiles to a binary file; LoadSheet maps it and decodes tiles on first use.
+ *
+ * Part 10: Optimistic Reads
+ *    - Writers publish versioned values after each write; GetCell2 and
+ * GetCells2 read a consistent snapshot without touching the lock.
+ *
+ * Part 11: Transactions, Undo and Redo
+ *    - A Transaction applies edits in place with an undo log and commits or
+ * aborts as a whole. Commits form an append-only change stream that Undo and
+ * Redo replay.
+ *
  * Requirements:
  *    1. Handle Dependencies:
  *        - If cell A1 depends on A2 and A3, changing A2 or A3 should
@@ -76,9 +127,95 @@ using namespace std;
  *    If multiple requests are concurrently sent to the spreadsheet, how would
  * you optimize for thread safety and more efficient lookups?
  */
+// Fixed-size pool for data-parallel loops. The caller and the workers claim
+// chunks of the index range from a shared counter, so a slow chunk never
+// holds back an idle thread.
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t num_threads) {
+    for (size_t i = 1; i < num_threads; ++i) {
+      threads_.emplace_back([this]() { Run(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard lock(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) {
+      t.join();
+    }
+  }
+
+  // Calls fn(begin, end) over [0, n) in chunks of `grain`; blocks until done.
+  // Not reentrant: one loop at a time.
+  void ParallelFor(size_t n, size_t grain,
+                   const std::function<void(size_t, size_t)> &fn) {
+    {
+      std::lock_guard lock(mtx_);
+      job_ = &fn;
+      n_ = n;
+      grain_ = std::max<size_t>(grain, 1);
+      next_.store(0);
+      busy_ = threads_.size();
+      ++generation_;
+    }
+    cv_.notify_all();
+    Work();
+    std::unique_lock lock(mtx_);
+    done_cv_.wait(lock, [this]() { return busy_ == 0; });
+    job_ = nullptr;
+  }
+
+private:
+  void Run() {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock lock(mtx_);
+        cv_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+      }
+      Work();
+      std::lock_guard lock(mtx_);
+      if (--busy_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  void Work() {
+    size_t begin;
+    while ((begin = next_.fetch_add(grain_)) < n_) {
+      (*job_)(begin, std::min(begin + grain_, n_));
+    }
+  }
+
+  vector<std::thread> threads_;
+  std::mutex mtx_;
+  std::condition_variable cv_, done_cv_;
+  const std::function<void(size_t, size_t)> *job_ = nullptr;
+  size_t n_ = 0, grain_ = 1, busy_ = 0;
+  std::atomic<size_t> next_{0};
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+};
+
 class Excel {
 public:
   using Val = std::variant<int, vector<string>>;
+  // Cell names are interned once into dense ids; the Part 2 state is indexed
+  // by id, so propagation never hashes a string.
+  using CellId = int32_t;
+  static constexpr CellId kNoCell = -1;
+  struct Formula;
+  struct UndoEntry;
+  class Transaction;
   Excel() = default;
   void SetCell(string cell, string val) {
     if (!to_graph_.count(cell)) {
@@ -111,107 +248,452 @@ public:
   }
 
   // SetCell2("A3", "=A1+A2"): from -> to: A3 -> A1, A3 -> A2
-  void SetCell2(string cell, string val) {
-    std::unique_lock lock(mtx_); // Exclusive writes
-    int num = 0;
-    int old_num = vals_.count(cell) ? vals_[cell] : 0;
-    // cout << "old_num = " << old_num << "\n";
+  void SetCell2(string cell, string val) { SetCells({{cell, val}}); }
+
+  // Applies every edit, then recomputes the union of cells reachable through
+  // from_ once each, so diamond-shaped fan-in no longer multiplies work.
+  // An edit that would introduce a cycle is reverted and reported after the
+  // edits before it have been committed.
+  void SetCells(const vector<pair<string, string>> &edits) {
+    Transaction txn(*this); // Exclusive writes
+    for (auto &[cell, val] : edits) {
+      try {
+        txn.Set(cell, val);
+      } catch (...) {
+        txn.Commit();
+        throw;
+      }
+    }
+    txn.Commit();
+  }
+
+  void Propagate(const vector<CellId> &roots) {
+    if (lazy_) {
+      MarkStale(roots);
+    } else {
+      Recalc(roots);
+    }
+  }
+
+  // "" clears the cell. With `undo`, the replaced formula and inputs are
+  // moved into it; nothing is recorded if the edit throws. With `roots`, the
+  // saved formulas of tiles loaded while compiling `val` are compiled (and
+  // added to `roots`) before its edges go in, so a cycle through one of them
+  // rejects the edit.
+  void ApplyEdit(CellId id, string val, UndoEntry *undo = nullptr,
+                 vector<CellId> *roots = nullptr) {
+    pending_.erase(id); // an edit overrides what the sheet file said
     try {
-      num = std::stoi(val);
-      // cout << "num = " << num << "\n";
-      // insert: No overwrite. returns pair<iterator, bool>
-      // insert_or_assign or [] can overwrite.
-      // to_map_.insert({cell, unordered_set<string>()});
-      to_map_.insert_or_assign(cell, unordered_set<string>());
-    } catch (...) {
-      vector<string> new_to_list = Extract(val);
-      unordered_set<string> old_to_list =
-          to_map_.count(cell) ? to_map_.at(cell) : unordered_set<string>();
-      to_map_[cell] =
-          unordered_set<string>(new_to_list.begin(), new_to_list.end());
-      unordered_set<string> visited;
-      if (IsCyclic(cell, visited, num)) {
-        to_map_[cell] = old_to_list; // revert to cells.
-        throw std::runtime_error("Cyclic Deps.");
+      // Plain values go through Recalc like formulas, so the ranges covering
+      // the cell see the change as a delta.
+      Formula value;
+      if (!val.empty()) {
+        size_t used = 0;
+        int num = std::stoi(val, &used);
+        if (used != val.size()) {
+          throw std::invalid_argument("not a number");
+        }
+        value.code.push_back(Instr{Instr::kConst, num});
+      }
+      vector<CellId> old_to_list = to_[id];
+      SetEdges(id, {});
+      ReleaseRanges(old_to_list);
+      ReplaceFormula(id, std::move(value), std::move(old_to_list), undo);
+    } catch (const std::invalid_argument &) {
+      Formula formula = FormulaCompiler(*this, val).Compile();
+      if (roots) {
+        DrainPending(*roots);
+      }
+      vector<CellId> new_to_list = formula.refs;
+      std::sort(new_to_list.begin(), new_to_list.end());
+      new_to_list.erase(std::unique(new_to_list.begin(), new_to_list.end()),
+                        new_to_list.end());
+      vector<CellId> old_to_list = to_[id];
+      SetEdges(id, {});
+      for (CellId to : new_to_list) {
+        if (!InsertEdge(id, to)) {
+          SetEdges(id, {}); // revert to cells.
+          for (CellId old_to : old_to_list) {
+            InsertEdge(id, old_to);
+          }
+          ReleaseRanges(new_to_list);
+          throw std::runtime_error("Cyclic Deps.");
+        }
+      }
+      ReleaseRanges(old_to_list);
+      ReplaceFormula(id, std::move(formula), std::move(old_to_list), undo);
+    }
+  }
+
+  void ReplaceFormula(CellId id, Formula formula, vector<CellId> old_to_list,
+                      UndoEntry *undo) {
+    if (undo) {
+      undo->id = id;
+      undo->formula = std::move(formulas_[id]);
+      undo->inputs = std::move(old_to_list);
+    }
+    formulas_[id] = std::move(formula);
+  }
+
+  // Replaces the "to" edges of `id` and keeps from_ in sync.
+  void SetEdges(CellId id, vector<CellId> to_list) {
+    for (CellId to : to_[id]) {
+      auto &froms = from_[to];
+      auto it = std::find(froms.begin(), froms.end(), id);
+      *it = froms.back(); // order of from_ is irrelevant: swap and pop.
+      froms.pop_back();
+    }
+    for (CellId to : to_list) {
+      from_[to].push_back(id);
+    }
+    to_[id] = std::move(to_list);
+  }
+
+  // Recomputes every formula reachable from `roots` exactly once.
+  void Recalc(const vector<CellId> &roots) {
+    // 1. Collect the dirty set: everything downstream of an edited cell.
+    NextEpoch();
+    vector<CellId> dirty;
+    vector<CellId> stk(roots.begin(), roots.end());
+    while (!stk.empty()) {
+      CellId id = stk.back();
+      stk.pop_back();
+      if (mark_[id] == epoch_) {
+        continue;
+      }
+      mark_[id] = epoch_;
+      dirty.push_back(id);
+      ForEachReader(id, [&](CellId from) { stk.push_back(from); });
+    }
+
+    // 2. Kahn's algorithm restricted to the dirty subgraph, one level at a
+    //    time: a cell lands one level after its deepest dirty input, so the
+    //    cells within a level never read each other. Every reader of a dirty
+    //    cell is dirty, so counting reader edges gives the dirty in-degree.
+    for (CellId id : dirty) {
+      in_degree_[id] = 0;
+    }
+    for (CellId id : dirty) {
+      ForEachReader(id, [&](CellId from) { ++in_degree_[from]; });
+    }
+    vector<CellId> frontier;
+    for (CellId id : dirty) {
+      if (in_degree_[id] == 0) {
+        frontier.push_back(id);
+      }
+    }
+    vector<vector<CellId>> levels;
+    while (!frontier.empty()) {
+      vector<CellId> next;
+      for (CellId id : frontier) {
+        ForEachReader(id, [&](CellId from) {
+          if (--in_degree_[from] == 0) {
+            next.push_back(from);
+          }
+        });
+      }
+      levels.push_back(std::move(frontier));
+      frontier = std::move(next);
+    }
+
+    // 3. Recompute level by level; a level's inputs are final before it runs.
+    //    Range nodes are not rescanned: each changed cell adds its delta to
+    //    the ranges covering it, which all sit in later levels.
+    const bool has_ranges = !stab_.empty();
+    vector<int> old_vals;
+    for (auto &level : levels) {
+      if (has_ranges) {
+        old_vals.resize(level.size());
+        for (size_t i = 0; i < level.size(); ++i) {
+          old_vals[i] = vals_[level[i]];
+        }
+      }
+      if (pool_ && level.size() > kRecalcGrain) {
+        pool_->ParallelFor(level.size(), kRecalcGrain,
+                           [&](size_t begin, size_t end) {
+                             for (size_t i = begin; i < end; ++i) {
+                               Evaluate(level[i]);
+                               PublishCell(level[i]);
+                             }
+                           });
       } else {
-        // update from cells
-        for (auto &to : new_to_list) {
-          auto it = from_map_.find(to);
-          if (it == from_map_.end()) {
-            from_map_.insert({to, {cell}});
-          } else {
-            it->second.insert(cell);
+        for (CellId id : level) {
+          Evaluate(id);
+          PublishCell(id);
+        }
+      }
+      if (has_ranges) {
+        for (size_t i = 0; i < level.size(); ++i) {
+          CellId id = level[i];
+          int delta = Wrap(int64_t{vals_[id]} - old_vals[i]);
+          if (delta != 0 && range_idx_[id] < 0) {
+            ForEachRangeContaining(keys_[id], [&](CellId range) {
+              vals_[range] = Wrap(int64_t{vals_[range]} + delta);
+            });
           }
         }
       }
     }
+  }
 
-    // for (auto &[k, v] : vals_) {
-    //   cout << "k = " << k << ", v = " << v << "\n";
-    // }
-    // for (auto &[k, v] : to_map_) {
-    //   cout << "to cells = " << k << ": ";
-    //   for (auto& to : v) {
-    //     cout << to;
-    //   }
-    //   cout << "\n";
-    // }
-    // for (auto &[k, v] : from_map_) {
-    //   cout << "from cells = " << k << ": ";
-    //   for (auto& from : v) {
-    //     cout << from;
-    //   }
-    //   cout << "\n";
-    // }
-
-    // BFS: propagate changes to "from" cells
-    int delta = num - old_num;
-    deque<string> que;
-    que.push_back(cell);
-    while (que.size() > 0) {
-      size_t lvl_size = que.size();
-      for (size_t i = 0; i < lvl_size; ++i) {
-        auto q_it = que.begin();
-        que.pop_front();
-        vals_[*q_it] += delta;
-        // cout << "Add " << *q_it << " by " << delta << "\n";
-        for (auto &from : from_map_[*q_it]) {
-          que.push_back(from);
+  // Cell arithmetic wraps modulo 2^32 instead of overflowing int, which is
+  // undefined. Range sums kept by deltas stay exact under the same wrap.
+  static int Wrap(int64_t v) { return static_cast<int>(static_cast<uint32_t>(v)); }
+
+  // Writes only vals_[id]; safe to run concurrently for cells of one level.
+  void Evaluate(CellId id) {
+    const Formula &f = formulas_[id];
+    if (f.code.empty()) {
+      if (range_idx_[id] < 0) {
+        vals_[id] = 0; // cleared, or never set
+      }
+      return;
+    }
+    int stk[kMaxStack];
+    int sp = 0;
+    for (const Instr &in : f.code) {
+      switch (in.op) {
+      case Instr::kConst:
+        stk[sp++] = in.arg;
+        break;
+      case Instr::kCell:
+        stk[sp++] = vals_[in.arg];
+        break;
+      case Instr::kAdd:
+        --sp;
+        stk[sp - 1] = Wrap(int64_t{stk[sp - 1]} + stk[sp]);
+        break;
+      case Instr::kSub:
+        --sp;
+        stk[sp - 1] = Wrap(int64_t{stk[sp - 1]} - stk[sp]);
+        break;
+      case Instr::kMul:
+        --sp;
+        stk[sp - 1] = Wrap(int64_t{stk[sp - 1]} * stk[sp]);
+        break;
+      case Instr::kDiv:
+        --sp;
+        // There are no error values in this sheet; x / 0 reads as 0, and
+        // INT_MIN / -1 wraps back to INT_MIN.
+        stk[sp - 1] = stk[sp] == 0 ? 0 : Wrap(int64_t{stk[sp - 1]} / stk[sp]);
+        break;
+      case Instr::kNeg:
+        stk[sp - 1] = Wrap(-int64_t{stk[sp - 1]});
+        break;
+      }
+    }
+    vals_[id] = stk[0];
+  }
+
+  // Part 8: lazy mode. Writes only mark the cells downstream of an edit as
+  // stale; GetCell2 recomputes just the stale cells a read depends on and
+  // keeps the results. Turning lazy mode off brings every stale cell current.
+  void SetLazy(bool lazy) {
+    WriteScope write(*this);
+    if (lazy_ && !lazy) {
+      vector<CellId> stale;
+      for (CellId id = 0; id < static_cast<CellId>(stale_.size()); ++id) {
+        if (stale_[id]) {
+          stale.push_back(id);
+          stale_[id] = 0;
         }
       }
+      Recalc(stale);
     }
+    lazy_ = lazy;
   }
 
-  // DFS + backtracking (don't forget to erase steps)
-  bool IsCyclic(string cell, unordered_set<string> &visited, int &num) {
-    visited.insert(cell);
-    auto it = to_map_.find(cell);
-    if (it == to_map_.end() || it->second.empty()) {
-      num += vals_.count(cell) ? vals_.at(cell) : 0;
-      visited.erase(cell); // erase step for backtracking.
-      return false;
+  // Invariant: every reader of a stale cell is stale, so the walk stops at
+  // cells that already are.
+  void MarkStale(const vector<CellId> &roots) {
+    vector<CellId> stk(roots.begin(), roots.end());
+    while (!stk.empty()) {
+      CellId id = stk.back();
+      stk.pop_back();
+      if (stale_[id]) {
+        continue;
+      }
+      stale_[id] = 1;
+      PublishCell(id);
+      ForEachReader(id, [&](CellId from) { stk.push_back(from); });
     }
+  }
 
-    for (auto &to : it->second) {
-      if (visited.contains(to)) {
-        return true;
+  // Post-order walk over stale inputs, then `id` itself.
+  void Refresh(CellId id) {
+    vector<pair<CellId, bool>> stk{{id, false}};
+    while (!stk.empty()) {
+      auto [cur, expanded] = stk.back();
+      if (!stale_[cur]) {
+        stk.pop_back();
+        continue;
       }
-      if (IsCyclic(to, visited, num)) {
-        return true;
+      if (expanded) {
+        stk.pop_back();
+        int old_val = vals_[cur];
+        Evaluate(cur);
+        stale_[cur] = 0;
+        PublishCell(cur);
+        int delta = Wrap(int64_t{vals_[cur]} - old_val);
+        if (delta != 0 && range_idx_[cur] < 0) {
+          ForEachRangeContaining(keys_[cur], [&](CellId range) {
+            vals_[range] = Wrap(int64_t{vals_[range]} + delta);
+          });
+        }
+        continue;
       }
+      stk.back().second = true;
+      ForEachInput(cur, [&](CellId input) {
+        if (stale_[input]) {
+          stk.push_back({input, false});
+        }
+      });
     }
-    visited.erase(cell); // erase step for backtracking.
-    return false;
   }
 
-  // O(1)
+  // Part 4: levels wider than kRecalcGrain are split across `num_threads`
+  // workers. 0 or 1 turns the parallel mode off.
+  void SetRecalcThreads(size_t num_threads) {
+    std::unique_lock lock(mtx_);
+    pool_ = num_threads > 1 ? std::make_unique<WorkerPool>(num_threads)
+                            : nullptr;
+  }
+
+  // Part 5: incremental cycle detection (Pearce-Kelly). ord_ keeps a
+  // topological order with every input ahead of the formulas reading it.
+  // Adding `id` -> `to` is free when ord_ already agrees; otherwise only the
+  // cells ordered between the two are searched and then reshuffled.
+  // Returns false, leaving the graph untouched, if the edge closes a cycle.
+  bool InsertEdge(CellId id, CellId to) {
+    if (to == id) {
+      return false;
+    }
+    if (ord_[to] > ord_[id] && !HasInputs(to)) {
+      // A cell without inputs may sit anywhere ahead of its readers; moving it
+      // to the front keeps back-to-front imports from re-searching the chain.
+      ord_[to] = --min_ord_;
+    }
+    if (ord_[to] > ord_[id]) {
+      const int lb = ord_[id], ub = ord_[to];
+      NextEpoch();
+      // Forward: formulas downstream of `id` that are ordered before `to`.
+      vector<CellId> fwd, stk{id};
+      mark_[id] = epoch_;
+      while (!stk.empty()) {
+        CellId cur = stk.back();
+        stk.pop_back();
+        fwd.push_back(cur);
+        bool cyclic = false;
+        ForEachReader(cur, [&](CellId from) {
+          if (from == to) {
+            cyclic = true;
+          } else if (mark_[from] != epoch_ && ord_[from] < ub) {
+            mark_[from] = epoch_;
+            stk.push_back(from);
+          }
+        });
+        if (cyclic) {
+          return false;
+        }
+      }
+      // Backward: inputs upstream of `to` that are ordered after `id`.
+      vector<CellId> bwd;
+      stk.push_back(to);
+      mark_[to] = epoch_;
+      while (!stk.empty()) {
+        CellId cur = stk.back();
+        stk.pop_back();
+        bwd.push_back(cur);
+        ForEachInput(cur, [&](CellId input) {
+          if (mark_[input] != epoch_ && ord_[input] > lb) {
+            mark_[input] = epoch_;
+            stk.push_back(input);
+          }
+        });
+      }
+      // Reuse the same positions: upstream cells first, then downstream.
+      auto by_ord = [this](CellId a, CellId b) { return ord_[a] < ord_[b]; };
+      std::sort(fwd.begin(), fwd.end(), by_ord);
+      std::sort(bwd.begin(), bwd.end(), by_ord);
+      vector<int> slots;
+      for (CellId c : bwd) {
+        slots.push_back(ord_[c]);
+      }
+      for (CellId c : fwd) {
+        slots.push_back(ord_[c]);
+      }
+      std::sort(slots.begin(), slots.end());
+      size_t i = 0;
+      for (CellId c : bwd) {
+        ord_[c] = slots[i++];
+      }
+      for (CellId c : fwd) {
+        ord_[c] = slots[i++];
+      }
+    }
+    to_[id].push_back(to);
+    from_[to].push_back(id);
+    return true;
+  }
+
+  // O(1), or the cost of the stale inputs in lazy mode, or of loading the
+  // cell's tile from the sheet file on first touch.
   int GetCell2(const string &cell) {
-    std::shared_lock lock(mtx_); // Concurrent reads
-    auto it = vals_.find(cell);
-    if (it == vals_.end()) {
+    uint64_t key = 0;
+    if (!CellKey(cell, key)) {
       return 0;
     }
-    return it->second;
+    int val = 0;
+    if (ReadSnapshot(&key, &val, 1)) {
+      return val; // Optimistic read, no lock
+    }
+    {
+      std::shared_lock lock(mtx_); // Concurrent reads
+      CellId id = FindKey(key);
+      if (id == kNoCell && !TileInFile(TileKey(key))) {
+        return 0;
+      }
+      if (id != kNoCell && !stale_[id]) {
+        return vals_[id];
+      }
+    }
+    WriteScope write(*this); // Refreshing or loading writes.
+    return ReadLocked(key);
+  }
+
+  // Values of `cells` as of one point in time: no write is seen half done.
+  // Unknown or malformed cells read as 0.
+  vector<int> GetCells2(const vector<string> &cells) {
+    vector<uint64_t> keys(cells.size(), 0);
+    for (size_t i = 0; i < cells.size(); ++i) {
+      CellKey(cells[i], keys[i]);
+    }
+    vector<int> vals(cells.size(), 0);
+    if (ReadSnapshot(keys.data(), vals.data(), keys.size())) {
+      return vals;
+    }
+    WriteScope write(*this);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      vals[i] = keys[i] == 0 ? 0 : ReadLocked(keys[i]);
+    }
+    return vals;
+  }
+
+  // Needs the exclusive lock.
+  int ReadLocked(uint64_t key) {
+    CellId id = FindKey(key);
+    if (id == kNoCell) {
+      LoadTile(TileKey(key));
+      vector<CellId> roots;
+      DrainPending(roots);
+      Propagate(roots);
+      id = FindKey(key);
+      if (id == kNoCell) {
+        return 0;
+      }
+    }
+    Refresh(id);
+    return vals_[id];
   }
 
   vector<string> Extract(string &val) {
@@ -228,11 +710,1183 @@ public:
     return ret;
   }
 
+  // Part 6: formulas are compiled once into postfix bytecode and evaluated on
+  // a fixed-size stack, so recalculation never touches formula text.
+  struct Instr {
+    enum Op : uint8_t { kConst, kCell, kAdd, kSub, kMul, kDiv, kNeg };
+    Op op;
+    int32_t arg = 0; // kConst: value, kCell: CellId (or range node)
+  };
+  struct Formula {
+    vector<Instr> code;  // empty for cells never set
+    vector<CellId> refs; // referenced cells and range nodes
+  };
+  static constexpr int kMaxStack = 64;
+
+  // Recursive descent over
+  //   expr    := term (('+' | '-') term)*
+  //   term    := unary (('*' | '/') unary)*
+  //   unary   := '-' unary | primary
+  //   primary := number | cell | SUM '(' cell [':' cell] ')' | '(' expr ')'
+  class FormulaCompiler {
+  public:
+    FormulaCompiler(Excel &ex, const string &text) : ex_(ex), s_(text) {
+      size_t eq = s_.find('=');
+      pos_ = eq == string::npos ? 0 : eq + 1;
+    }
+
+    Formula Compile() {
+      try {
+        Expr();
+        if (Peek() != '\0') {
+          Fail("unexpected character");
+        }
+      } catch (...) {
+        ex_.ReleaseRanges(f_.refs);
+        throw;
+      }
+      return std::move(f_);
+    }
+
+  private:
+    void Expr() {
+      Term();
+      for (char c = Peek(); c == '+' || c == '-'; c = Peek()) {
+        ++pos_;
+        Term();
+        Emit(c == '+' ? Instr::kAdd : Instr::kSub);
+      }
+    }
+
+    void Term() {
+      Unary();
+      for (char c = Peek(); c == '*' || c == '/'; c = Peek()) {
+        ++pos_;
+        Unary();
+        Emit(c == '*' ? Instr::kMul : Instr::kDiv);
+      }
+    }
+
+    void Unary() {
+      if (++nesting_ > kMaxStack) {
+        Fail("formula too deep");
+      }
+      if (Peek() == '-') {
+        ++pos_;
+        Unary();
+        Emit(Instr::kNeg);
+      } else {
+        Primary();
+      }
+      --nesting_;
+    }
+
+    void Primary() {
+      char c = Peek();
+      if (c == '(') {
+        ++pos_;
+        Expr();
+        Expect(')');
+      } else if (std::isdigit(static_cast<unsigned char>(c))) {
+        int64_t num = 0;
+        while (std::isdigit(static_cast<unsigned char>(Cur()))) {
+          num = num * 10 + (s_[pos_++] - '0');
+          if (num > std::numeric_limits<int>::max()) {
+            Fail("constant out of range");
+          }
+        }
+        Emit(Instr::kConst, static_cast<int32_t>(num));
+      } else if (std::isupper(static_cast<unsigned char>(c))) {
+        size_t start = pos_;
+        while (std::isupper(static_cast<unsigned char>(Cur()))) {
+          ++pos_;
+        }
+        if (Cur() == '(') {
+          if (s_.compare(start, pos_ - start, "SUM") != 0) {
+            pos_ = start;
+            Fail("unknown function");
+          }
+          ++pos_;
+          Range();
+          Expect(')');
+        } else {
+          pos_ = start;
+          CellId id = Cell();
+          Emit(Instr::kCell, id);
+          f_.refs.push_back(id);
+        }
+      } else {
+        Fail("expected operand");
+      }
+    }
+
+    // SUM(A1:B3) covers the rectangle between the two corners.
+    void Range() {
+      Peek();
+      uint64_t lo = CellKeyAt();
+      uint64_t hi = lo;
+      if (Peek() == ':') {
+        ++pos_;
+        Peek();
+        hi = CellKeyAt();
+      }
+      CellId id = ex_.InternRange(
+          std::min(lo >> 32, hi >> 32), std::max(lo >> 32, hi >> 32),
+          std::min(lo & 0xffffffff, hi & 0xffffffff),
+          std::max(lo & 0xffffffff, hi & 0xffffffff));
+      Emit(Instr::kCell, id);
+      f_.refs.push_back(id);
+    }
+
+    CellId Cell() { return ex_.InternKey(CellKeyAt()); }
+
+    uint64_t CellKeyAt() {
+      size_t start = pos_;
+      while (std::isalnum(static_cast<unsigned char>(Cur()))) {
+        ++pos_;
+      }
+      uint64_t key = 0;
+      if (!CellKey(s_.substr(start, pos_ - start), key)) {
+        pos_ = start;
+        Fail("bad cell reference");
+      }
+      return key;
+    }
+
+    void Emit(Instr::Op op, int32_t arg = 0) { Push(Instr{op, arg}); }
+
+    void Push(const Instr &in) {
+      depth_ += in.op <= Instr::kCell ? 1 : in.op == Instr::kNeg ? 0 : -1;
+      if (depth_ > kMaxStack) {
+        Fail("formula too deep");
+      }
+      f_.code.push_back(in);
+    }
+
+    char Cur() const { return pos_ < s_.size() ? s_[pos_] : '\0'; }
+
+    // Skips blanks and returns the next character, '\0' at the end.
+    char Peek() {
+      while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_]))) {
+        ++pos_;
+      }
+      return Cur();
+    }
+
+    void Expect(char c) {
+      if (Peek() != c) {
+        Fail(string("expected '") + c + "'");
+      }
+      ++pos_;
+    }
+
+    [[noreturn]] void Fail(const string &msg) {
+      throw std::runtime_error("Bad formula at " + std::to_string(pos_) +
+                               ": " + msg);
+    }
+
+    Excel &ex_;
+    const string &s_;
+    size_t pos_ = 0;
+    int depth_ = 0;   // operand stack depth after the emitted code
+    int nesting_ = 0; // recursion guard
+    Formula f_;
+  };
+
+  // "AB12" -> column 28 (bijective base 26) in the high half, row 12 in the
+  // low half. Returns false if `cell` is not letters followed by digits.
+  static bool CellKey(const string &cell, uint64_t &key) {
+    size_t i = 0;
+    uint64_t col = 0, row = 0;
+    while (i < cell.size() && std::isupper(static_cast<unsigned char>(cell[i]))) {
+      col = col * 26 + (cell[i++] - 'A' + 1);
+      if (col > std::numeric_limits<uint32_t>::max()) {
+        return false;
+      }
+    }
+    size_t digits = i;
+    while (i < cell.size() && std::isdigit(static_cast<unsigned char>(cell[i]))) {
+      row = row * 10 + (cell[i++] - '0');
+      if (row > std::numeric_limits<uint32_t>::max()) {
+        return false;
+      }
+    }
+    if (digits == 0 || i == digits || i != cell.size()) {
+      return false;
+    }
+    key = col << 32 | row;
+    return true;
+  }
+
+  static string CellName(uint64_t key) {
+    string col;
+    for (uint64_t c = key >> 32; c > 0; c = (c - 1) / 26) {
+      col.push_back(static_cast<char>('A' + (c - 1) % 26));
+    }
+    std::reverse(col.begin(), col.end());
+    return col + std::to_string(key & 0xffffffff);
+  }
+
+  // Part 9: cells live in a sparse grid of 64 x 64 tiles allocated on
+  // demand. Tiles are ordered by (tile column, tile row), so the tiles of a
+  // column band are contiguous for range scans.
+  static constexpr uint32_t kTileBits = 6;
+  static constexpr uint32_t kTileSize = 1u << kTileBits;
+  // Slots are atomic so lock-free readers can look cells up (Part 10).
+  struct Tile {
+    std::array<std::atomic<CellId>, kTileSize * kTileSize> ids;
+    Tile() {
+      for (auto &id : ids) {
+        id.store(kNoCell, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  static uint64_t TileKey(uint64_t key) {
+    return (key >> 32 >> kTileBits) << 32 | (key & 0xffffffff) >> kTileBits;
+  }
+
+  static size_t TileSlot(uint64_t key) {
+    return (key & (kTileSize - 1)) * kTileSize + (key >> 32 & (kTileSize - 1));
+  }
+
+  CellId FindKey(uint64_t key) const {
+    auto it = tiles_.find(TileKey(key));
+    return it == tiles_.end()
+               ? kNoCell
+               : it->second->ids[TileSlot(key)].load(std::memory_order_relaxed);
+  }
+
+  std::atomic<CellId> &GridSlot(uint64_t key) {
+    auto &tile = tiles_[TileKey(key)];
+    if (!tile) {
+      tile = std::make_unique<Tile>();
+      ShareTile(TileKey(key), tile.get());
+    }
+    return tile->ids[TileSlot(key)];
+  }
+
+  // Calls fn(id) for every cell inside the rectangle.
+  template <typename Fn>
+  void ForEachCellIn(uint32_t col_lo, uint32_t col_hi, uint32_t row_lo,
+                     uint32_t row_hi, Fn fn) const {
+    for (uint64_t tc = col_lo >> kTileBits; tc <= col_hi >> kTileBits; ++tc) {
+      auto it = tiles_.lower_bound(tc << 32 | row_lo >> kTileBits);
+      if (it == tiles_.end()) {
+        return;
+      }
+      if ((it->first >> 32) != tc) { // skip the empty tile columns
+        tc = (it->first >> 32) - 1;
+        continue;
+      }
+      auto end = tiles_.upper_bound(tc << 32 | row_hi >> kTileBits);
+      for (; it != end; ++it) {
+        uint64_t tr = it->first & 0xffffffff;
+        uint64_t c0 = std::max<uint64_t>(col_lo, tc << kTileBits);
+        uint64_t c1 = std::min<uint64_t>(col_hi, (tc << kTileBits) + kTileSize - 1);
+        uint64_t r0 = std::max<uint64_t>(row_lo, tr << kTileBits);
+        uint64_t r1 = std::min<uint64_t>(row_hi, (tr << kTileBits) + kTileSize - 1);
+        for (uint64_t r = r0; r <= r1; ++r) {
+          for (uint64_t c = c0; c <= c1; ++c) {
+            CellId id = it->second->ids[TileSlot(c << 32 | r)].load(
+                std::memory_order_relaxed);
+            if (id != kNoCell) {
+              fn(id);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Part 10: optimistic reads. Every write holds the lock through a
+  // WriteScope, which numbers it; each cell value it changes is published
+  // as an atomic (version, stale, value) word, and the version is released
+  // in published_ when the write ends. The word a cell had before the
+  // current write is kept in `prev`, so a reader pinned to published_ V
+  // takes `newest` if its version is <= V, else `prev`. Readers only load
+  // atomics and never write shared memory, so they scale across cores.
+  class WriteScope {
+  public:
+    explicit WriteScope(Excel &ex) : ex_(ex), lock_(ex.mtx_) {}
+    ~WriteScope() {
+      ex_.published_.store(ex_.write_version_, std::memory_order_release);
+      if (++ex_.write_version_ > kMaxVersion) {
+        ex_.RebaseVersions();
+      }
+    }
+    WriteScope(const WriteScope &) = delete;
+    WriteScope &operator=(const WriteScope &) = delete;
+
+  private:
+    Excel &ex_;
+    std::unique_lock<std::shared_mutex> lock_;
+  };
+
+  // Published words of 4096 consecutive cell ids.
+  static constexpr size_t kReadChunkBits = 12;
+  static constexpr size_t kReadChunkSize = size_t{1} << kReadChunkBits;
+  static constexpr size_t kReadChunks = size_t{1} << 15; // 128M cell ids
+  struct ReadChunk {
+    std::atomic<uint64_t> newest[kReadChunkSize] = {};
+    std::atomic<uint64_t> prev[kReadChunkSize] = {};
+  };
+  static constexpr uint64_t kMaxVersion = (uint64_t{1} << 31) - 1;
+  static constexpr uint64_t kStaleBit = uint64_t{1} << 32;
+
+  // Lock-free TileKey -> Tile map for readers; open addressing, filled by
+  // the writer only. A full table is copied into one twice the size and the
+  // old one is retired, not freed, since readers may still be probing it.
+  struct ReadTable {
+    explicit ReadTable(size_t capacity)
+        : mask(capacity - 1),
+          keys(std::make_unique<std::atomic<uint64_t>[]>(capacity)),
+          tiles(std::make_unique<std::atomic<const Tile *>[]>(capacity)) {}
+
+    const Tile *Find(uint64_t tile_key) const {
+      for (size_t i = Hash(tile_key);; i = (i + 1) & mask) {
+        uint64_t k = keys[i].load(std::memory_order_acquire);
+        if (k == tile_key + 1) {
+          return tiles[i].load(std::memory_order_relaxed);
+        }
+        if (k == 0) {
+          return nullptr;
+        }
+      }
+    }
+
+    void Insert(uint64_t tile_key, const Tile *tile) {
+      size_t i = Hash(tile_key);
+      while (keys[i].load(std::memory_order_relaxed) != 0) {
+        i = (i + 1) & mask;
+      }
+      tiles[i].store(tile, std::memory_order_relaxed);
+      keys[i].store(tile_key + 1, std::memory_order_release); // 0 is empty
+      ++size;
+    }
+
+    size_t Hash(uint64_t tile_key) const {
+      return static_cast<size_t>((tile_key * 0x9E3779B97F4A7C15ull) >> 20) &
+             mask;
+    }
+
+    size_t mask;
+    size_t size = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> keys;
+    std::unique_ptr<std::atomic<const Tile *>[]> tiles;
+  };
+
+  void ShareTile(uint64_t tile_key, const Tile *tile) {
+    ReadTable *table = read_tables_.back().get();
+    if ((table->size + 1) * 2 > table->mask + 1) {
+      auto bigger = std::make_unique<ReadTable>((table->mask + 1) * 2);
+      for (auto &[k, t] : tiles_) {
+        if (t && t.get() != tile) {
+          bigger->Insert(k, t.get());
+        }
+      }
+      table = bigger.get();
+      read_tables_.push_back(std::move(bigger));
+    }
+    table->Insert(tile_key, tile);
+    read_table_.store(table, std::memory_order_release);
+  }
+
+  // Publishes vals_[id] and stale_[id] as part of the current write. Ranges
+  // are never read by cell name, so they are skipped.
+  void PublishCell(CellId id) {
+    if (range_idx_[id] >= 0) {
+      return;
+    }
+    ReadChunk &chunk = *read_owned_[static_cast<size_t>(id) >> kReadChunkBits];
+    const size_t i = static_cast<size_t>(id) & (kReadChunkSize - 1);
+    uint64_t word = write_version_ << 33 | (stale_[id] ? kStaleBit : 0) |
+                    static_cast<uint32_t>(vals_[id]);
+    uint64_t cur = chunk.newest[i].load(std::memory_order_relaxed);
+    if (cur >> 33 != write_version_) {
+      chunk.prev[i].store(cur, std::memory_order_relaxed);
+    }
+    chunk.newest[i].store(word, std::memory_order_release); // orders prev too
+  }
+
+  // Reads all `n` keys as of the last finished write. Returns false, and the
+  // caller takes the lock, if a cell is missing, stale, or changed twice since
+  // that write.
+  bool ReadSnapshot(const uint64_t *keys, int *vals, size_t n) const {
+    const uint64_t rebase = rebase_seq_.load(std::memory_order_acquire);
+    if (rebase & 1) {
+      return false;
+    }
+    const uint64_t version = published_.load(std::memory_order_acquire);
+    const ReadTable *table = read_table_.load(std::memory_order_acquire);
+    for (size_t k = 0; k < n; ++k) {
+      const Tile *tile = table ? table->Find(TileKey(keys[k])) : nullptr;
+      if (!tile) {
+        return false;
+      }
+      CellId id = tile->ids[TileSlot(keys[k])].load(std::memory_order_acquire);
+      if (id == kNoCell) {
+        return false;
+      }
+      const ReadChunk &chunk = *read_chunks_[static_cast<size_t>(id) >>
+                                             kReadChunkBits]
+                                    .load(std::memory_order_acquire);
+      const size_t i = static_cast<size_t>(id) & (kReadChunkSize - 1);
+      uint64_t word = chunk.newest[i].load(std::memory_order_acquire);
+      if (word >> 33 > version) {
+        word = chunk.prev[i].load(std::memory_order_relaxed);
+      }
+      if (word >> 33 == 0 || word >> 33 > version || (word & kStaleBit)) {
+        return false;
+      }
+      vals[k] = static_cast<int32_t>(static_cast<uint32_t>(word));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return rebase_seq_.load(std::memory_order_relaxed) == rebase;
+  }
+
+  // Versions are 31 bits. When they run out, every cell is republished as
+  // version 1; rebase_seq_ is odd meanwhile, so readers caught in between
+  // retry under the lock instead of mixing old and new numbering.
+  void RebaseVersions() {
+    rebase_seq_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    write_version_ = 1;
+    for (CellId id = 0; id < static_cast<CellId>(keys_.size()); ++id) {
+      if (range_idx_[id] < 0) {
+        ReadChunk &chunk = *read_owned_[static_cast<size_t>(id) >> kReadChunkBits];
+        chunk.prev[id & (kReadChunkSize - 1)].store(0, std::memory_order_relaxed);
+        PublishCell(id);
+      }
+    }
+    published_.store(write_version_++, std::memory_order_release);
+    rebase_seq_.fetch_add(1, std::memory_order_release);
+  }
+
+  // Part 11: transactions. Edits are applied in place; each one logs the
+  // formula and inputs it replaced, moved out rather than copied. Abort
+  // walks the log backwards, so rolling back costs O(cells edited), and
+  // recalculates once. Commit appends the edits to the change stream.
+  struct UndoEntry {
+    CellId id = kNoCell;
+    Formula formula;       // replaced formula
+    vector<CellId> inputs; // its inputs
+  };
+  struct Change {
+    string cell, before, after; // "" for an empty cell
+  };
+  struct ChangeRecord {
+    uint64_t seq; // 1, 2, ... in commit order
+    vector<Change> changes;
+  };
+
+  // Holds the write lock until destroyed; a transaction that was neither
+  // committed nor aborted aborts then. Use Set and Get, not the Excel
+  // methods, while it is open.
+  class Transaction {
+  public:
+    explicit Transaction(Excel &ex) : ex_(ex), write_(ex) { ex_.txn_ = this; }
+    ~Transaction() {
+      if (ex_.txn_ == this) {
+        Abort();
+      }
+    }
+    Transaction(const Transaction &) = delete;
+    Transaction &operator=(const Transaction &) = delete;
+
+    // A failed edit changes nothing; the transaction stays open.
+    void Set(const string &cell, const string &val) {
+      CheckOpen();
+      CellId id = ex_.Intern(cell);
+      ex_.DrainPending(roots_); // the cell's saved formula, if any, first
+      UndoEntry entry;
+      ex_.ApplyEdit(id, val, &entry, &roots_);
+      undo_.push_back(std::move(entry));
+      after_.push_back(val);
+      roots_.push_back(id);
+    }
+
+    // Sees this transaction's edits.
+    int Get(const string &cell) {
+      CheckOpen();
+      uint64_t key = 0;
+      if (!CellKey(cell, key)) {
+        return 0;
+      }
+      Flush();
+      return ex_.ReadLocked(key);
+    }
+
+    void Commit() {
+      CheckOpen();
+      Flush();
+      if (!undo_.empty()) {
+        ChangeRecord rec{ex_.changes_.size() + 1, {}};
+        rec.changes.reserve(undo_.size());
+        for (size_t i = 0; i < undo_.size(); ++i) {
+          rec.changes.push_back({CellName(ex_.keys_[undo_[i].id]),
+                                 ex_.Source(undo_[i].formula),
+                                 std::move(after_[i])});
+        }
+        ex_.changes_.push_back(std::move(rec));
+        if (!replay_) {
+          ex_.undo_stack_.push_back(ex_.changes_.size() - 1);
+          ex_.redo_stack_.clear();
+        }
+      }
+      Finish();
+    }
+
+    void Abort() {
+      CheckOpen();
+      for (auto it = undo_.rbegin(); it != undo_.rend(); ++it) {
+        const CellId id = it->id;
+        auto &released = ex_.txn_released_;
+        released.insert(released.end(), ex_.to_[id].begin(), ex_.to_[id].end());
+        ex_.SetEdges(id, {});
+        for (CellId to : it->inputs) {
+          // Restores a graph that was acyclic, so this cannot fail.
+          ex_.InsertEdge(id, to);
+        }
+        ex_.formulas_[id] = std::move(it->formula);
+        roots_.push_back(id);
+      }
+      Flush();
+      Finish();
+    }
+
+  private:
+    friend class Excel;
+
+    void CheckOpen() const {
+      if (ex_.txn_ != this) {
+        throw std::runtime_error("Transaction is finished");
+      }
+    }
+
+    void Flush() {
+      ex_.Propagate(roots_);
+      roots_.clear();
+    }
+
+    void Finish() {
+      ex_.txn_ = nullptr;
+      ex_.ReleaseRanges(ex_.txn_released_);
+      ex_.txn_released_.clear();
+      undo_.clear();
+      after_.clear();
+    }
+
+    Excel &ex_;
+    WriteScope write_;
+    vector<UndoEntry> undo_;
+    vector<string> after_;   // new text of each undo_ entry
+    vector<CellId> roots_;   // edited since the last Flush
+    bool replay_ = false;    // Undo or Redo: leave the stacks alone
+  };
+
+  // Reverts the last committed transaction by committing its inverse.
+  // Returns false if there is nothing to undo.
+  bool Undo() { return Replay(undo_stack_, redo_stack_, true); }
+
+  // Re-applies the last undone transaction.
+  bool Redo() { return Replay(redo_stack_, undo_stack_, false); }
+
+  bool Replay(vector<size_t> &from, vector<size_t> &to, bool undo) {
+    Transaction txn(*this);
+    if (from.empty()) {
+      return false;
+    }
+    const size_t idx = from.back();
+    const vector<Change> &changes = changes_[idx].changes;
+    if (undo) {
+      for (auto it = changes.rbegin(); it != changes.rend(); ++it) {
+        txn.Set(it->cell, it->before);
+      }
+    } else {
+      for (const Change &c : changes) {
+        txn.Set(c.cell, c.after);
+      }
+    }
+    txn.replay_ = true;
+    txn.Commit();
+    from.pop_back();
+    to.push_back(idx);
+    return true;
+  }
+
+  // The change stream: every record committed after `seq`.
+  vector<ChangeRecord> ReadChanges(uint64_t seq) {
+    std::shared_lock lock(mtx_);
+    if (seq >= changes_.size()) {
+      return {};
+    }
+    return vector<ChangeRecord>(changes_.begin() + seq, changes_.end());
+  }
+
+  // Text that recreates `f` through SetCell2.
+  string Source(const Formula &f) const {
+    if (f.code.empty()) {
+      return "";
+    }
+    if (f.code.size() == 1 && f.code[0].op == Instr::kConst) {
+      return std::to_string(f.code[0].arg);
+    }
+    return Decompile(f);
+  }
+
+  CellId Intern(const string &cell) {
+    uint64_t key = 0;
+    if (!CellKey(cell, key)) {
+      throw std::runtime_error("INVALID CELL");
+    }
+    return InternKey(key);
+  }
+
+  CellId InternKey(uint64_t key) {
+    CellId id = FindKey(key);
+    if (id != kNoCell) {
+      return id;
+    }
+    if (TileInFile(TileKey(key))) {
+      LoadTile(TileKey(key));
+      if ((id = FindKey(key)) != kNoCell) {
+        return id;
+      }
+    }
+    id = NewNode(key);
+    PublishCell(id);
+    GridSlot(key).store(id, std::memory_order_release);
+    bool covered = false;
+    ForEachRangeContaining(key, [&](CellId) { covered = true; });
+    if (covered) { // must be ordered ahead of the ranges covering it.
+      ord_[id] = --min_ord_;
+    }
+    return id;
+  }
+
+  CellId NewNode(uint64_t key) {
+    CellId id = static_cast<CellId>(keys_.size());
+    keys_.push_back(key);
+    vals_.push_back(0);
+    formulas_.emplace_back();
+    to_.emplace_back();
+    from_.emplace_back();
+    mark_.push_back(0);
+    in_degree_.push_back(0);
+    ord_.push_back(static_cast<int>(ord_.size()));
+    range_idx_.push_back(-1);
+    stale_.push_back(0);
+    if ((static_cast<size_t>(id) & (kReadChunkSize - 1)) == 0) {
+      size_t chunk = static_cast<size_t>(id) >> kReadChunkBits;
+      if (chunk == kReadChunks) {
+        throw std::runtime_error("Too many cells");
+      }
+      read_owned_.push_back(std::make_unique<ReadChunk>());
+      read_chunks_[chunk].store(read_owned_.back().get(),
+                                std::memory_order_release);
+    }
+    return id;
+  }
+
+  // Part 7: a SUM rectangle is a single graph node shared by every formula
+  // naming it. Its value is the cached sum of the cells it covers, kept up to
+  // date with deltas instead of rescans. Readers of a cell are the formulas
+  // naming it plus the ranges covering it.
+  struct Range {
+    uint32_t col_lo, col_hi, row_lo, row_hi;
+    CellId id; // kNoCell once dropped
+  };
+
+  CellId InternRange(uint32_t col_lo, uint32_t col_hi, uint32_t row_lo,
+                     uint32_t row_hi) {
+    auto [it, inserted] =
+        range_ids_.try_emplace({col_lo, col_hi, row_lo, row_hi}, kNoCell);
+    if (!inserted) {
+      return it->second;
+    }
+    LoadTilesIn(col_lo, col_hi, row_lo, row_hi);
+    CellId id = NewNode(kRangeKey);
+    int32_t idx = static_cast<int32_t>(ranges_.size());
+    range_idx_[id] = idx;
+    ranges_.push_back({col_lo, col_hi, row_lo, row_hi, id});
+    ForEachBlock(col_lo, col_hi, [&](int col_level, uint64_t col_node) {
+      ForEachBlock(row_lo, row_hi, [&](int row_level, uint64_t row_node) {
+        stab_[{col_node, row_node}].push_back(idx);
+        stab_levels_[col_level] |= 1ull << row_level;
+      });
+    });
+    int sum = 0;
+    ForEachInput(id, [&](CellId cell) { sum = Wrap(int64_t{sum} + vals_[cell]); });
+    vals_[id] = sum;
+    // The sum above may include stale values; refreshing those members later
+    // corrects it through their deltas.
+    stale_[id] = lazy_;
+    it->second = id;
+    return id;
+  }
+
+  // Drops range nodes among `refs` that no formula reads any more. Inside a
+  // transaction this waits for the end, since an abort may need them back.
+  void ReleaseRanges(const vector<CellId> &refs) {
+    if (txn_) {
+      txn_released_.insert(txn_released_.end(), refs.begin(), refs.end());
+      return;
+    }
+    for (CellId id : refs) {
+      int32_t idx = range_idx_[id];
+      if (idx < 0 || !from_[id].empty() || ranges_[idx].id == kNoCell) {
+        continue;
+      }
+      Range &rg = ranges_[idx];
+      ForEachBlock(rg.col_lo, rg.col_hi, [&](int, uint64_t col_node) {
+        ForEachBlock(rg.row_lo, rg.row_hi, [&](int, uint64_t row_node) {
+          auto it = stab_.find({col_node, row_node});
+          auto &list = it->second;
+          *std::find(list.begin(), list.end(), idx) = list.back();
+          list.pop_back();
+          if (list.empty()) {
+            stab_.erase(it);
+          }
+        });
+      });
+      range_ids_.erase({rg.col_lo, rg.col_hi, rg.row_lo, rg.row_hi});
+      rg.id = kNoCell;
+    }
+  }
+
+  // Splits rows (or columns) [lo, hi] into aligned power-of-two blocks.
+  // Block (level, n) covers [n << level, (n + 1) << level) and is numbered
+  // like a heap node, so the blocks containing one row are the <= 33 on its
+  // root path. A rectangle is indexed under every (column block, row block)
+  // pair of its two splits: O(log width * log height) entries.
+  template <typename Fn> static void ForEachBlock(uint64_t lo, uint64_t hi, Fn fn) {
+    const uint64_t end = hi + 1;
+    while (lo < end) {
+      int level = lo == 0 ? 32 : std::min(32, std::countr_zero(lo));
+      while ((1ull << level) > end - lo) {
+        --level;
+      }
+      fn(level, BlockNode(level, lo >> level));
+      lo += 1ull << level;
+    }
+  }
+
+  static uint64_t BlockNode(int level, uint64_t prefix) {
+    return (1ull << (32 - level)) | prefix;
+  }
+
+  // Stabbing query: calls fn(range node) for every range covering `key`.
+  template <typename Fn> void ForEachRangeContaining(uint64_t key, Fn fn) {
+    if (stab_.empty()) {
+      return;
+    }
+    const uint64_t col = key >> 32;
+    const uint64_t row = key & 0xffffffff;
+    for (int col_level = 0; col_level <= 32; ++col_level) {
+      const uint64_t col_node = BlockNode(col_level, col >> col_level);
+      for (uint64_t levels = stab_levels_[col_level]; levels != 0;
+           levels &= levels - 1) {
+        int level = std::countr_zero(levels);
+        auto it = stab_.find({col_node, BlockNode(level, row >> level)});
+        if (it == stab_.end()) {
+          continue;
+        }
+        for (int32_t idx : it->second) {
+          fn(ranges_[idx].id);
+        }
+      }
+    }
+  }
+
+  template <typename Fn> void ForEachReader(CellId id, Fn fn) {
+    for (CellId from : from_[id]) {
+      fn(from);
+    }
+    if (range_idx_[id] < 0) {
+      ForEachRangeContaining(keys_[id], fn);
+    }
+  }
+
+  // Inputs of a range node are the cells that exist inside its rectangle.
+  template <typename Fn> void ForEachInput(CellId id, Fn fn) {
+    int32_t idx = range_idx_[id];
+    if (idx < 0) {
+      for (CellId to : to_[id]) {
+        fn(to);
+      }
+      return;
+    }
+    const Range &rg = ranges_[idx];
+    ForEachCellIn(rg.col_lo, rg.col_hi, rg.row_lo, rg.row_hi, fn);
+  }
+
+  bool HasInputs(CellId id) {
+    if (range_idx_[id] < 0) {
+      return !to_[id].empty();
+    }
+    bool found = false;
+    ForEachInput(id, [&](CellId) { found = true; });
+    return found;
+  }
+
+  // Sheet file: the tile grid written out as-is, so opening a sheet only maps
+  // the file and reads the tile directory. A tile is decoded the first time
+  // any of its cells is touched.
+  //
+  //   "XLS1" | u32 tile_count | dir[tile_count] | tile payloads
+  //   dir:    u64 tile_key | u64 offset | u32 cell_count | u32 byte_count
+  //   cell:   u16 slot | u8 kind | i32 value | u32 text_len | formula text
+  //
+  // Directory entries are sorted by tile key. Formulas are stored as text
+  // decompiled from their bytecode and recompiled on load; their values are
+  // recomputed then, so cells loaded later always see current inputs.
+  void SaveSheet(const string &path) {
+    WriteScope write(*this);
+    LoadAllTiles();
+    string out(kSheetMagic, sizeof(kSheetMagic));
+    PutInt<uint32_t>(out, tiles_.size());
+    const size_t dir_pos = out.size();
+    out.resize(dir_pos + tiles_.size() * kDirEntrySize);
+    size_t entry = dir_pos;
+    for (auto &[tile_key, tile] : tiles_) {
+      size_t begin = out.size();
+      uint32_t count = 0;
+      for (size_t slot = 0; slot < tile->ids.size(); ++slot) {
+        CellId id = tile->ids[slot].load(std::memory_order_relaxed);
+        if (id == kNoCell || formulas_[id].code.empty()) {
+          continue; // referenced but never set
+        }
+        const Formula &f = formulas_[id];
+        bool is_value = f.code.size() == 1 && f.code[0].op == Instr::kConst;
+        string text = is_value ? "" : Decompile(f);
+        PutInt<uint16_t>(out, slot);
+        PutInt<uint8_t>(out, is_value ? kValueCell : kFormulaCell);
+        // In lazy mode vals_ may be stale; a constant's own value is not.
+        PutInt<int32_t>(out, is_value ? f.code[0].arg : vals_[id]);
+        PutInt<uint32_t>(out, text.size());
+        out.append(text);
+        ++count;
+      }
+      string header;
+      PutInt<uint64_t>(header, tile_key);
+      PutInt<uint64_t>(header, begin);
+      PutInt<uint32_t>(header, count);
+      PutInt<uint32_t>(header, out.size() - begin);
+      out.replace(entry, kDirEntrySize, header);
+      entry += kDirEntrySize;
+    }
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if (!ofs.write(out.data(), out.size())) {
+      throw std::runtime_error("Cannot write " + path);
+    }
+  }
+
+  // Maps `path` into an empty sheet; tiles are decoded on first touch.
+  void LoadSheet(const string &path) {
+    WriteScope write(*this);
+    if (!keys_.empty() || file_) {
+      throw std::runtime_error("LoadSheet needs an empty sheet");
+    }
+    auto file = std::make_unique<MappedFile>(path);
+    const char *p = file->data;
+    size_t n = file->size;
+    if (n < sizeof(kSheetMagic) + 4 ||
+        std::memcmp(p, kSheetMagic, sizeof(kSheetMagic)) != 0) {
+      throw std::runtime_error("Bad sheet file");
+    }
+    size_t pos = sizeof(kSheetMagic);
+    uint32_t tile_count = GetInt<uint32_t>(p, n, pos);
+    if (tile_count > (n - pos) / kDirEntrySize) {
+      throw std::runtime_error("Bad sheet file");
+    }
+    file_dir_ = pos;
+    file_tiles_ = tile_count;
+    file_loaded_.assign(tile_count, 0);
+    file_ = std::move(file);
+  }
+
+  // Key of the i-th entry of the file directory, which is sorted by key.
+  uint64_t FileTileKey(size_t i) const {
+    size_t pos = file_dir_ + i * kDirEntrySize;
+    return GetInt<uint64_t>(file_->data, file_->size, pos);
+  }
+
+  // First directory entry whose key is >= `tile_key` (lower bound).
+  size_t FileTileLowerBound(uint64_t tile_key) const {
+    size_t lo = 0, hi = file_tiles_;
+    while (lo < hi) { // binary search straight over the mapped directory
+      size_t mid = (lo + hi) / 2;
+      if (FileTileKey(mid) < tile_key) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  // Position of `tile_key` in the file directory, or -1.
+  int64_t FileTileIndex(uint64_t tile_key) const {
+    if (!file_) {
+      return -1;
+    }
+    size_t i = FileTileLowerBound(tile_key);
+    return i < file_tiles_ && FileTileKey(i) == tile_key ? static_cast<int64_t>(i)
+                                                         : -1;
+  }
+
+  bool TileInFile(uint64_t tile_key) const {
+    int64_t idx = FileTileIndex(tile_key);
+    return idx >= 0 && !file_loaded_[idx];
+  }
+
+  // Creates the tile's cells. Values are set right away; formulas are queued
+  // in pending_ and compiled by DrainPending, so loading never recurses.
+  void LoadTile(uint64_t tile_key) {
+    int64_t idx = FileTileIndex(tile_key);
+    if (idx >= 0) {
+      LoadTileAt(idx, tile_key);
+    }
+  }
+
+  void LoadTileAt(size_t idx, uint64_t tile_key) {
+    if (file_loaded_[idx]) {
+      return;
+    }
+    file_loaded_[idx] = 1;
+    const char *p = file_->data;
+    const size_t n = file_->size;
+    size_t pos = file_dir_ + idx * kDirEntrySize + 8;
+    uint64_t offset = GetInt<uint64_t>(p, n, pos);
+    uint32_t count = GetInt<uint32_t>(p, n, pos);
+    pos = offset;
+    const uint64_t base = (tile_key >> 32 << kTileBits) << 32 |
+                          (tile_key & 0xffffffff) << kTileBits;
+    for (uint32_t i = 0; i < count; ++i) {
+      uint16_t slot = GetInt<uint16_t>(p, n, pos);
+      uint8_t kind = GetInt<uint8_t>(p, n, pos);
+      int32_t value = GetInt<int32_t>(p, n, pos);
+      uint32_t len = GetInt<uint32_t>(p, n, pos);
+      if (slot >= kTileSize * kTileSize || len > n - pos) {
+        throw std::runtime_error("Bad sheet file");
+      }
+      uint64_t key = base + (uint64_t{slot} % kTileSize << 32) + slot / kTileSize;
+      CellId id = InternKey(key);
+      vals_[id] = value;
+      PublishCell(id);
+      if (kind == kValueCell) {
+        formulas_[id] = Formula{{Instr{Instr::kConst, value}}, {}};
+      } else {
+        pending_[id] = std::string_view(p + pos, len);
+      }
+      pos += len;
+    }
+  }
+
+  void LoadTilesIn(uint32_t col_lo, uint32_t col_hi, uint32_t row_lo,
+                   uint32_t row_hi) {
+    if (!file_) {
+      return;
+    }
+    // A column's tiles are contiguous in the sorted directory: seek to the
+    // first one in range and stop at the first key past it.
+    for (uint64_t tc = col_lo >> kTileBits; tc <= col_hi >> kTileBits; ++tc) {
+      uint64_t last = tc << 32 | row_hi >> kTileBits;
+      size_t i = FileTileLowerBound(tc << 32 | row_lo >> kTileBits);
+      if (i == file_tiles_) {
+        return;
+      }
+      if ((FileTileKey(i) >> 32) != tc) { // skip the empty tile columns
+        tc = (FileTileKey(i) >> 32) - 1;
+        continue;
+      }
+      for (; i < file_tiles_; ++i) {
+        uint64_t k = FileTileKey(i);
+        if (k > last) {
+          break;
+        }
+        LoadTileAt(i, k);
+      }
+    }
+  }
+
+  void LoadAllTiles() {
+    if (!file_) {
+      return;
+    }
+    for (size_t i = 0; i < file_tiles_; ++i) {
+      LoadTileAt(i, FileTileKey(i));
+    }
+    vector<CellId> roots;
+    DrainPending(roots);
+    Propagate(roots);
+  }
+
+  // Compiles queued formulas from the sheet file. Compiling may touch more
+  // tiles, which queue more formulas; all of them become recalc roots.
+  void DrainPending(vector<CellId> &roots) {
+    while (!pending_.empty()) {
+      auto it = pending_.begin();
+      CellId id = it->first;
+      string text(it->second);
+      pending_.erase(it);
+      ApplyEdit(id, text);
+      roots.push_back(id);
+    }
+  }
+
+  // Inverse of FormulaCompiler; every binary operation is parenthesized.
+  string Decompile(const Formula &f) const {
+    vector<string> stk;
+    for (const Instr &in : f.code) {
+      if (in.op == Instr::kConst) {
+        stk.push_back(std::to_string(in.arg));
+      } else if (in.op == Instr::kCell) {
+        int32_t idx = range_idx_[in.arg];
+        if (idx < 0) {
+          stk.push_back(CellName(keys_[in.arg]));
+        } else {
+          const Range &rg = ranges_[idx];
+          stk.push_back("SUM(" + CellName(uint64_t{rg.col_lo} << 32 | rg.row_lo) +
+                        ":" + CellName(uint64_t{rg.col_hi} << 32 | rg.row_hi) +
+                        ")");
+        }
+      } else if (in.op == Instr::kNeg) {
+        stk.back() = "(-" + stk.back() + ")";
+      } else {
+        static const char kOps[] = "+-*/";
+        string rhs = std::move(stk.back());
+        stk.pop_back();
+        stk.back() = "(" + stk.back() + kOps[in.op - Instr::kAdd] + rhs + ")";
+      }
+    }
+    return "=" + stk.back();
+  }
+
+  struct MappedFile {
+    explicit MappedFile(const string &path) {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+      }
+      struct stat st;
+      if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat " + path);
+      }
+      size = static_cast<size_t>(st.st_size);
+      void *addr = size ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                        : nullptr;
+      ::close(fd);
+      if (addr == MAP_FAILED) {
+        throw std::runtime_error("Cannot map " + path);
+      }
+      data = static_cast<const char *>(addr);
+    }
+    ~MappedFile() {
+      if (data) {
+        ::munmap(const_cast<char *>(data), size);
+      }
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data = nullptr;
+    size_t size = 0;
+  };
+
+  template <typename T> static void PutInt(string &out, T v) {
+    auto u = static_cast<std::make_unsigned_t<T>>(v);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      out.push_back(static_cast<char>((u >> (8 * i)) & 0xff));
+    }
+  }
+
+  template <typename T>
+  static T GetInt(const char *in, size_t n, size_t &pos) {
+    if (pos > n || sizeof(T) > n - pos) {
+      throw std::runtime_error("Bad sheet file");
+    }
+    std::make_unsigned_t<T> u = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      u |= static_cast<std::make_unsigned_t<T>>(
+               static_cast<unsigned char>(in[pos + i]))
+           << (8 * i);
+    }
+    pos += sizeof(T);
+    return static_cast<T>(u);
+  }
+
+  void NextEpoch() {
+    if (++epoch_ == 0) { // wrapped: stale marks could collide, reset them.
+      std::fill(mark_.begin(), mark_.end(), 0);
+      epoch_ = 1;
+    }
+  }
+
   std::shared_mutex mtx_; // Pessimistic Two-phase lock (2PL)
   unordered_map<string, Val> to_graph_;
-  unordered_map<string, unordered_set<string>> to_map_;
-  unordered_map<string, int> vals_;
-  unordered_map<string, unordered_set<string>> from_map_;
+
+  std::map<uint64_t, std::unique_ptr<Tile>> tiles_; // TileKey -> tile
+  vector<uint64_t> keys_; // id -> CellKey, kRangeKey for ranges
+  vector<int> vals_;
+  vector<Formula> formulas_;
+  vector<vector<CellId>> to_;       // deduplicated inputs of each formula
+  vector<vector<CellId>> from_;     // formulas that read each cell
+  vector<int> ord_;                 // topological position, see InsertEdge
+  int min_ord_ = 0;
+  // Scratch for graph walks, stamped with epoch_ instead of being cleared.
+  vector<uint32_t> mark_;
+  vector<int> in_degree_;
+  uint32_t epoch_ = 0;
+
+  struct BlockHash {
+    size_t operator()(const pair<uint64_t, uint64_t> &b) const {
+      return std::hash<uint64_t>()(b.second * 0x9E3779B97F4A7C15ull ^ b.first);
+    }
+  };
+  static constexpr uint64_t kRangeKey = ~0ull;
+  vector<int32_t> range_idx_; // id -> index in ranges_, -1 for cells
+  vector<Range> ranges_;
+  map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>, CellId> range_ids_;
+  // (column block, row block) -> ranges that include that whole rectangle.
+  unordered_map<pair<uint64_t, uint64_t>, vector<int32_t>, BlockHash> stab_;
+  // [C] bit R: some block of 2^C columns by 2^R rows is indexed.
+  std::array<uint64_t, 33> stab_levels_{};
+
+  static constexpr char kSheetMagic[4] = {'X', 'L', 'S', '1'};
+  static constexpr size_t kDirEntrySize = 24;
+  static constexpr uint8_t kValueCell = 0, kFormulaCell = 1;
+  std::unique_ptr<MappedFile> file_;
+  size_t file_dir_ = 0;   // offset of the tile directory
+  size_t file_tiles_ = 0; // directory entries
+  vector<uint8_t> file_loaded_;
+  unordered_map<CellId, std::string_view> pending_; // formula text in file_
+
+  bool lazy_ = false;
+  vector<uint8_t> stale_; // lazy mode: value not yet recomputed
+
+  static constexpr size_t kRecalcGrain = 256; // cells per parallel chunk
+  std::unique_ptr<WorkerPool> pool_;
+
+  std::atomic<uint64_t> published_{0}; // version of the last finished write
+  uint64_t write_version_ = 1;         // version of the write in progress
+  std::atomic<uint64_t> rebase_seq_{0};
+  std::unique_ptr<std::atomic<ReadChunk *>[]> read_chunks_ =
+      std::make_unique<std::atomic<ReadChunk *>[]>(kReadChunks);
+  vector<std::unique_ptr<ReadChunk>> read_owned_;
+  vector<std::unique_ptr<ReadTable>> read_tables_ = [] {
+    vector<std::unique_ptr<ReadTable>> tables;
+    tables.push_back(std::make_unique<ReadTable>(64));
+    return tables;
+  }();
+  std::atomic<const ReadTable *> read_table_{nullptr};
+
+  Transaction *txn_ = nullptr; // open transaction, if any
+  vector<CellId> txn_released_;
+  vector<ChangeRecord> changes_;
+  vector<size_t> undo_stack_, redo_stack_; // indices into changes_
 };
 
 int main() {
@@ -339,5 +1993,260 @@ int main() {
   for (auto& t : read_threads) {
     t.join();
   }
+
+  cout << "\n======  Diamond fan-in, batched edits ======\n";
+  // F0 feeds F1..F20 through a diamond at every level.
+  ex.SetCell2("F0", "1");
+  for (int i = 1; i <= 20; ++i) {
+    string prev = "F" + std::to_string(i - 1);
+    ex.SetCells({{"G" + std::to_string(i), "=" + prev},
+                 {"H" + std::to_string(i), "=" + prev},
+                 {"F" + std::to_string(i),
+                  "=G" + std::to_string(i) + "+H" + std::to_string(i)}});
+  }
+  cout << "F20 = " << ex.GetCell2("F20") << " [EXPECTED: 1048576]\n";
+  ex.SetCells({{"F0", "2"}, {"C1", "0"}, {"C2", "0"}});
+  cout << "F20 = " << ex.GetCell2("F20") << " [EXPECTED: 2097152]\n";
+  cout << "A5 = " << ex.GetCell2("A5") << " [EXPECTED: 2]\n";
+
+  cout << "\n======  Multi-letter columns, repeated terms ======\n";
+  ex.SetCell2("AA1", "5");
+  ex.SetCell2("AB12", "=AA1+AA1+A2");
+  cout << "AB12 = " << ex.GetCell2("AB12") << " [EXPECTED: 12]\n";
+  try {
+    ex.SetCell2("1A", "3");
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << " [EXPECTED: 'INVALID CELL' error]\n";
+  }
+
+  cout << "\n======  Parallel recalc of a wide level ======\n";
+  Excel wide;
+  wide.SetRecalcThreads(4);
+  vector<pair<string, string>> edits;
+  string total = "=";
+  for (int i = 1; i <= 5000; ++i) {
+    string p = "P" + std::to_string(i), q = "Q" + std::to_string(i);
+    edits.push_back({p, std::to_string(i)});
+    edits.push_back({q, "=" + p + "+" + p});
+    total += (i > 1 ? "+" : "") + q;
+  }
+  edits.push_back({"R1", total});
+  wide.SetCells(edits);
+  cout << "Q5000 = " << wide.GetCell2("Q5000") << " [EXPECTED: 10000]\n";
+  cout << "R1 = " << wide.GetCell2("R1") << " [EXPECTED: 25005000]\n";
+  edits.clear();
+  for (int i = 1; i <= 5000; ++i) {
+    edits.push_back({"P" + std::to_string(i), "1"});
+  }
+  wide.SetCells(edits);
+  cout << "Q77 = " << wide.GetCell2("Q77") << " [EXPECTED: 2]\n";
+  cout << "R1 = " << wide.GetCell2("R1") << " [EXPECTED: 10000]\n";
+
+  cout << "\n======  Bulk import of long formula chains ======\n";
+  Excel chain;
+  const int kChain = 100000;
+  chain.SetCell2("S1", "1");
+  for (int i = 2; i <= kChain; ++i) {
+    chain.SetCell2("S" + std::to_string(i), "=S" + std::to_string(i - 1) + "+S1");
+  }
+  // Imported back to front as one batch: every edit refers to a cell ordered
+  // after it, and the whole chain is recalculated once at the end.
+  vector<pair<string, string>> import;
+  for (int i = kChain; i >= 2; --i) {
+    import.push_back({"T" + std::to_string(i), "=T" + std::to_string(i - 1)});
+  }
+  chain.SetCells(import);
+  chain.SetCell2("T1", "=S" + std::to_string(kChain));
+  cout << "S100000 = " << chain.GetCell2("S100000") << " [EXPECTED: 100000]\n";
+  cout << "T100000 = " << chain.GetCell2("T100000") << " [EXPECTED: 100000]\n";
+  try {
+    chain.SetCell2("S1", "=T100000");
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << " [EXPECTED: 'Cyclic Deps' error]\n";
+  }
+  chain.SetCell2("S1", "2");
+  cout << "T100000 = " << chain.GetCell2("T100000") << " [EXPECTED: 200000]\n";
+
+  cout << "\n======  Compiled formulas ======\n";
+  Excel calc;
+  calc.SetCells({{"A1", "6"}, {"A2", "4"}, {"B1", "=A1*2-(A2+3)/2"},
+                 {"B2", "= -A1 * -A2"}, {"B3", "=SUM(A1:A2)*10"},
+                 {"B4", "=SUM(A1:B3)"}, {"B5", "=A1/(A2-4)"}});
+  cout << "B1 = " << calc.GetCell2("B1") << " [EXPECTED: 9]\n";
+  cout << "B2 = " << calc.GetCell2("B2") << " [EXPECTED: 24]\n";
+  cout << "B3 = " << calc.GetCell2("B3") << " [EXPECTED: 100]\n";
+  cout << "B4 = " << calc.GetCell2("B4") << " [EXPECTED: 143]\n";
+  cout << "B5 = " << calc.GetCell2("B5") << " [EXPECTED: 0]\n";
+  calc.SetCell2("A2", "5");
+  cout << "B4 = " << calc.GetCell2("B4") << " [EXPECTED: 159]\n";
+  cout << "B5 = " << calc.GetCell2("B5") << " [EXPECTED: 6]\n";
+  // Overflow wraps to 32 bits rather than being undefined.
+  calc.SetCells({{"C1", "=-259602 * 86782"}, {"C2", "=(0-2147483647-1)/-1"},
+                 {"C3", "=-(0-2147483647-1)"}, {"C4", "=2147483647+1"}});
+  cout << "C1 = " << calc.GetCell2("C1") << " [EXPECTED: -1053944284]\n";
+  cout << "C2 = " << calc.GetCell2("C2") << " [EXPECTED: -2147483648]\n";
+  cout << "C3 = " << calc.GetCell2("C3") << " [EXPECTED: -2147483648]\n";
+  cout << "C4 = " << calc.GetCell2("C4") << " [EXPECTED: -2147483648]\n";
+  try {
+    calc.SetCell2("B6", "=A1 + * A2");
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what()
+              << " [EXPECTED: 'Bad formula at 6: expected operand']\n";
+  }
+  try {
+    calc.SetCell2("B7", "=SUM(B1:B7)");
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << " [EXPECTED: 'Cyclic Deps' error]\n";
+  }
+
+  cout << "\n======  Huge column ranges ======\n";
+  Excel model;
+  edits.clear();
+  for (int i = 1; i <= 50000; ++i) {
+    edits.push_back({"V" + std::to_string(i), "2"});
+  }
+  edits.push_back({"W1", "=SUM(V1:V100000)"});
+  edits.push_back({"W2", "=SUM(V100000:V1) * 2 + W1"});
+  edits.push_back({"W3", "=SUM(U1:V3)"});
+  model.SetCells(edits);
+  cout << "W1 = " << model.GetCell2("W1") << " [EXPECTED: 100000]\n";
+  cout << "W2 = " << model.GetCell2("W2") << " [EXPECTED: 300000]\n";
+  model.SetCells({{"V500", "7"}, {"V70000", "=V500+1"}, {"U2", "4"}});
+  cout << "W1 = " << model.GetCell2("W1") << " [EXPECTED: 100013]\n";
+  cout << "W2 = " << model.GetCell2("W2") << " [EXPECTED: 300039]\n";
+  cout << "W3 = " << model.GetCell2("W3") << " [EXPECTED: 10]\n";
+  model.SetCell2("V500", "0");
+  cout << "W1 = " << model.GetCell2("W1") << " [EXPECTED: 99999]\n";
+  model.SetCell2("W3", "=SUM(V1:V2)");
+  model.SetCell2("V1", "10");
+  cout << "W3 = " << model.GetCell2("W3") << " [EXPECTED: 12]\n";
+  try {
+    model.SetCell2("V99", "=W1");
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << " [EXPECTED: 'Cyclic Deps' error]\n";
+  }
+  cout << "W1 = " << model.GetCell2("W1") << " [EXPECTED: 100007]\n";
+  {
+    // Wide rectangles cost O(log width * log height) index entries, so the
+    // whole sheet below row 1 is as cheap as a column.
+    Excel wide;
+    wide.SetCells({{"B2", "3"},
+                   {"XFD70000", "4"},
+                   {"A1", "=SUM(A2:MWLQKWU4294967295)"},
+                   {"B1", "=SUM(A2:ZZZZZ2)"}});
+    wide.SetCell2("ZZZZY2", "10");
+    cout << "A1 = " << wide.GetCell2("A1") << " [EXPECTED: 17]\n";
+    cout << "B1 = " << wide.GetCell2("B1") << " [EXPECTED: 13]\n";
+  }
+
+  cout << "\n======  Lazy evaluation ======\n";
+  model.SetLazy(true);
+  for (int i = 1; i <= 1000; ++i) {
+    model.SetCell2("V1", std::to_string(i)); // only marks W1, W2, W3 stale
+  }
+  model.SetCell2("V2", "=V1*3");
+  model.SetCell2("X1", "=W3+1");
+  cout << "W3 = " << model.GetCell2("W3") << " [EXPECTED: 4000]\n";
+  cout << "X1 = " << model.GetCell2("X1") << " [EXPECTED: 4001]\n";
+  cout << "W1 = " << model.GetCell2("W1") << " [EXPECTED: 103995]\n";
+  model.SetCell2("V3", "1");
+  model.SetLazy(false);
+  cout << "W2 = " << model.GetCell2("W2") << " [EXPECTED: 311982]\n";
+
+  cout << "\n======  Sheet files, opened lazily ======\n";
+  model.SetCells({{"Y1", "=-(W3 - 1) * 2 / 4"}, {"Y2", "=SUM(V1:W2)"}});
+  model.SaveSheet("sheet.xls1");
+  {
+    Excel opened;
+    opened.LoadSheet("sheet.xls1");
+    cout << "V2 = " << opened.GetCell2("V2") << " [EXPECTED: 3000]\n";
+    cout << "Y1 = " << opened.GetCell2("Y1") << " [EXPECTED: -1999]\n";
+    cout << "Q1 = " << opened.GetCell2("Q1") << " [EXPECTED: 0]\n";
+    opened.SetCell2("V1", "1");
+    cout << "W1 = " << opened.GetCell2("W1") << " [EXPECTED: 99998]\n";
+    cout << "Y2 = " << opened.GetCell2("Y2") << " [EXPECTED: 399996]\n";
+    cout << "Y1 = " << opened.GetCell2("Y1") << " [EXPECTED: -1]\n";
+  }
+  {
+    // B100 sits in a tile not loaded yet when A1's formula reaches it.
+    Excel small;
+    small.SetLazy(true); // A1 is stale when saved; its value must not be
+    small.SetCells({{"A1", "5"}, {"B100", "=A1+1"}});
+    small.SaveSheet("sheet.xls1");
+    Excel opened;
+    opened.LoadSheet("sheet.xls1");
+    try {
+      opened.SetCell2("A1", "=B100");
+    } catch (const std::exception &e) {
+      std::cerr << "Error: " << e.what() << " [EXPECTED: 'Cyclic Deps' error]\n";
+    }
+    cout << "A1 = " << opened.GetCell2("A1") << " [EXPECTED: 5]\n";
+    opened.SetCell2("A1", "7");
+    cout << "B100 = " << opened.GetCell2("B100") << " [EXPECTED: 8]\n";
+  }
+  std::remove("sheet.xls1");
+
+  cout << "\n======  Optimistic reads during writes ======\n";
+  Excel live;
+  live.SetCells({{"K1", "0"}, {"K2", "=K1*2"}, {"K3", "=K2-K1"}});
+  std::atomic<bool> writing{true};
+  std::atomic<int> torn{0};
+  vector<thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&]() {
+      while (writing.load()) {
+        vector<int> v = live.GetCells2({"K1", "K2", "K3"});
+        if (v[1] != 2 * v[0] || v[2] != v[0]) {
+          ++torn;
+        }
+      }
+    });
+  }
+  for (int i = 1; i <= 20000; ++i) {
+    live.SetCell2("K1", std::to_string(i));
+  }
+  writing = false;
+  for (auto &t : readers) {
+    t.join();
+  }
+  cout << "torn snapshots = " << torn.load() << " [EXPECTED: 0]\n";
+  cout << "K3 = " << live.GetCell2("K3") << " [EXPECTED: 20000]\n";
+
+  cout << "\n======  Transactions, undo and redo ======\n";
+  Excel book;
+  book.SetCells({{"A1", "1"}, {"A2", "=A1*10"}, {"A3", "=SUM(A1:A2)"}});
+  {
+    Excel::Transaction txn(book);
+    txn.Set("A1", "5");
+    txn.Set("A2", "=A1+A4");
+    cout << "A3 = " << txn.Get("A3") << " [EXPECTED: 10]\n";
+    try {
+      txn.Set("A4", "=A3");
+    } catch (const std::exception &e) {
+      std::cerr << "Error: " << e.what() << " [EXPECTED: 'Cyclic Deps' error]\n";
+    }
+  } // not committed: rolled back
+  cout << "A3 = " << book.GetCell2("A3") << " [EXPECTED: 11]\n";
+  book.SetCells({{"A1", "2"}, {"B1", "=A3*2"}});
+  cout << "B1 = " << book.GetCell2("B1") << " [EXPECTED: 44]\n";
+  book.Undo();
+  cout << "B1 = " << book.GetCell2("B1") << " [EXPECTED: 0]\n";
+  cout << "A3 = " << book.GetCell2("A3") << " [EXPECTED: 11]\n";
+  book.Redo();
+  cout << "B1 = " << book.GetCell2("B1") << " [EXPECTED: 44]\n";
+  book.Undo();
+  book.Undo();
+  cout << "A3 = " << book.GetCell2("A3") << " [EXPECTED: 0]\n";
+  cout << "undo again = " << book.Undo() << " [EXPECTED: 0]\n";
+  book.Redo();
+  cout << "A3 = " << book.GetCell2("A3") << " [EXPECTED: 11]\n";
+  auto stream = book.ReadChanges(2);
+  cout << "records after #2 = " << stream.size() << " [EXPECTED: 5]\n";
+  string undone; // cell{before|after}
+  for (const auto &c : stream[0].changes) {
+    undone += c.cell + "{" + c.before + "|" + c.after + "}";
+  }
+  cout << "#" << stream[0].seq << " = " << undone
+       << " [EXPECTED: B1{=(A3*2)|}A1{2|1}]\n";
   return 0;
 }
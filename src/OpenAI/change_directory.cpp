@@ -1,7 +1,9 @@
 #include <algorithm> // For std::sort and std::find
+#include <atomic>
 #include <bitset>    // For bit manipulation
 #include <cassert>   // For assertions
 #include <chrono>    // For timing
+#include <condition_variable>
 #include <cmath>     // For mathematical functions
 #include <cstdint>
 #include <ctime> // For time functions
@@ -14,14 +16,15 @@
 #include <iostream>
 #include <iostream> // For std::cout and std::cin
 #include <limits>   // For numeric limits
+#include <list>
 #include <map> // For std::map and multimap that allows duplicate values in sorted order
+#include <memory>
 #include <mutex> // For mutexes
 #include <optional>
 #include <queue> // For std::priority_queue
 #include <random>
 #include <set>
 #include <shared_mutex> // std::shared_mutex
-#include <sstream>
 #include <stdexcept>
 #include <string> // For std::string
 #include <string_view>
@@ -72,6 +75,36 @@ using namespace std;
  * being `/xyz`.
  *    - If there is a cyclic dependency, throw an exception.
  *
+ * Part 4: Compiled Soft Links
+ *    - The link table is compiled once into a trie over path components
+ * (LinkTrie), so each hop finds the longest matching link in one walk and
+ * the same table serves any number of `cd` calls.
+ *
+ * Part 5: Allocation-free Normalization
+ *    - PathNormalizer tokenizes with string_view and rewrites into a buffer
+ * it keeps between calls, so a warmed-up call does not allocate.
+ *
+ * Part 6: Cached Resolution
+ *    - LinkResolver owns an editable link table and a bounded LRU of resolved
+ * paths. Every link edit bumps a version; entries from older versions are
+ * dropped when next looked up.
+ *
+ * Part 7: Batch Resolution
+ *    - cdBatch resolves many (pwd, path) pairs on a pool of threads sharing
+ * one read-only LinkTrie. Duplicate pairs are resolved once and all results
+ * are packed into one output arena.
+ *
+ * Part 8: In-memory Directory Tree
+ *    - Vfs keeps real directory nodes (interned names, parent pointers,
+ * child hash tables) in an arena, so `cd`, soft links, `ls` and `mkdir -p`
+ * walk pointers instead of rebuilding path strings. FileSystem owns one, and
+ * cdTree resolves against it with cd's longest-link rule and hop budget.
+ *
+ * Part 9: Bounded Iterative Resolution
+ *    - Every string resolver rewrites one buffer in a loop and gives up
+ * after a configurable number of hops (40 by default, like ELOOP); the hop
+ * chain can be reported for diagnostics.
+ *
  * Examples:
  *    cd("/home/", ".") -> "/home/"
  *    cd("/home/", "./ada") -> "/home/ada"
@@ -84,143 +117,787 @@ using namespace std;
  * "/xyz" cd("/foo/bar", "baz", {/foo/bar: /abc, /foo/bar/baz: /xyz}) -> "/xyz"
  */
 
-class FileSystem {
+// Soft links keyed by path components: node 0 is "/", and a node marks the
+// end of a link source when `link` >= 0. Immutable once built. Children are
+// keyed by views into names_, so lookups take slices of the path directly.
+class LinkTrie {
 public:
-  FileSystem() = default;
-  // soft link map. Assume key and value of each pair is good path - start with
-  // '/' and last dir name ending without '/', like "/foo/bar/openai".
-  // `const &` can bind to temporary values (rvalue), non-const & can't (because
-  // any modification for `softlinks` map will lost after the function if we
-  // pass a temporary rvalue.)
-  string cd(const string &pwd, const string &in,
-            const unordered_map<string, string> &softlinks = {}) {
-    // /a/b/c, ../d/e = /a/b/d/e
+  LinkTrie() = default;
+  // Moves keep the views valid (deque storage is handed over); copies would
+  // not.
+  LinkTrie(LinkTrie &&) = default;
+  LinkTrie &operator=(LinkTrie &&) = default;
+  LinkTrie(const LinkTrie &) = delete;
+  LinkTrie &operator=(const LinkTrie &) = delete;
+
+  // A named factory rather than a constructor, so that brace-initialized
+  // maps passed to FileSystem::cd keep meaning the map overload.
+  static LinkTrie Compile(const unordered_map<string, string> &softlinks) {
+    LinkTrie trie;
+    trie.Build(softlinks);
+    return trie;
+  }
+
+  bool empty() const { return targets_.empty(); }
+
+  // Longest link source that is a whole-component prefix of the normalized
+  // absolute `path`; -1 if none. `len` is the prefix length in bytes.
+  int LongestPrefix(string_view path, size_t &len) const {
+    int best = -1;
+    int node = 0;
+    for (size_t begin = 1; begin < path.size() && !nodes_.empty();) {
+      size_t end = std::min(path.find('/', begin), path.size());
+      auto it = nodes_[node].children.find(path.substr(begin, end - begin));
+      if (it == nodes_[node].children.end()) {
+        break;
+      }
+      node = it->second;
+      if (nodes_[node].link >= 0) {
+        best = nodes_[node].link;
+        len = end;
+      }
+      begin = end + 1;
+    }
+    return best;
+  }
+
+  // Normalized target, "/" for the root.
+  const string &Target(int link) const { return targets_[link]; }
+
+private:
+  void Build(const unordered_map<string, string> &softlinks) {
+    nodes_.emplace_back();
+    for (auto &[from, to] : softlinks) {
+      int node = 0;
+      ForEachDir(from, [&](string_view dir) {
+        auto it = nodes_[node].children.find(dir);
+        if (it == nodes_[node].children.end()) {
+          int child = static_cast<int>(nodes_.size());
+          nodes_[node].children.emplace(names_.emplace_back(dir), child);
+          nodes_.emplace_back(); // invalidates references into nodes_
+          node = child;
+        } else {
+          node = it->second;
+        }
+      });
+      nodes_[node].link = static_cast<int>(targets_.size());
+      string target;
+      ForEachDir(to, [&](string_view dir) {
+        target += '/';
+        target += dir;
+      });
+      targets_.push_back(target.empty() ? "/" : target);
+    }
+  }
+
+  template <typename Fn> static void ForEachDir(string_view path, Fn fn) {
+    size_t begin = 0;
+    while (begin < path.size()) {
+      size_t end = std::min(path.find('/', begin), path.size());
+      if (end > begin) {
+        fn(path.substr(begin, end - begin));
+      }
+      begin = end + 1;
+    }
+  }
+
+  struct Node {
+    unordered_map<string_view, int> children;
+    int link = -1; // index into targets_
+  };
+  vector<Node> nodes_;
+  std::deque<string> names_; // component names viewed by the children maps
+  vector<string> targets_;
+};
+
+// Scratch buffers survive between calls: after the first few paths,
+// Normalize runs without touching the allocator. One instance per thread.
+class PathNormalizer {
+public:
+  // Absolute form of `in` relative to `pwd`, or "null" if it climbs above
+  // "/". The result views an internal buffer (or `pwd` when `in` is empty)
+  // and stays valid until the next call. "." and ".." inside `pwd` are
+  // resolved too.
+  string_view Normalize(string_view pwd, string_view in) {
     if (in.empty()) {
       return pwd;
     }
-    vector<string> out_list;
-    vector<string> dirs;
-    if (in.at(0) == '/') {
-      // start from root
-      dirs = ExtractDirs(in.substr(1));
-    } else if (in.at(0) == '~') {
-      // user home: "~/proj/openai"
-      out_list.push_back("home");
-      out_list.push_back("user");
-      if (in.size() > 2) {
-        dirs = ExtractDirs(in.substr(2));
-      }
+    buf_.clear();
+    starts_.clear();
+    bool ok;
+    if (in[0] == '/') {
+      ok = Append(in);
+    } else if (in[0] == '~') {
+      ok = Append("/home/user") && Append(in.substr(1));
     } else {
-      // start with "." or ".." or a dir name like "foo".
-      vector<string> pwd_dirs = ExtractDirs(pwd.substr(1)); // skip first "/"
-      out_list.insert(out_list.end(), pwd_dirs.begin(), pwd_dirs.end());
-      // cout << "in = " << in << "\n";
-      dirs = ExtractDirs(in);
-    }
-    // cout << "out_list size = " << out_list.size() << "\n";
-    // cout << "dirs size = " << dirs.size() << "\n";
-    for (auto &d : dirs) {
-      if (d.empty()) {
-        continue;
+      ok = Append(pwd) && Append(in);
+    }
+    if (!ok) {
+      return "null";
+    }
+    if (buf_.empty()) {
+      buf_.push_back('/');
+    }
+    return buf_;
+  }
+
+private:
+  // Applies the segments of `path` to buf_; starts_ holds the offset of
+  // each segment's '/', so ".." is a truncate.
+  bool Append(string_view path) {
+    size_t begin = 0;
+    while (begin < path.size()) {
+      size_t end = path.find('/', begin);
+      if (end == string_view::npos) {
+        end = path.size();
       }
-      if (d == ".") {
+      string_view seg = path.substr(begin, end - begin);
+      begin = end + 1;
+      if (seg.empty() || seg == ".") {
         continue;
       }
-      if (d == "..") {
-        if (out_list.empty()) {
-          return "null";
+      if (seg == "..") {
+        if (starts_.empty()) {
+          return false;
         }
-        out_list.pop_back();
+        buf_.resize(starts_.back());
+        starts_.pop_back();
       } else {
-        out_list.push_back(d);
+        starts_.push_back(buf_.size());
+        buf_.push_back('/');
+        buf_.append(seg);
       }
     }
+    return true;
+  }
+
+  string buf_;
+  vector<size_t> starts_;
+};
+
+// An editable link table plus an LRU cache of resolved paths. Cached
+// entries carry the table version they were computed under, so editing a
+// link is O(1) and stale entries are discarded lazily.
+class LinkResolver {
+public:
+  explicit LinkResolver(size_t capacity = 4096) : capacity_(capacity) {}
+
+  void SetLink(const string &from, const string &to) {
+    links_[from] = to;
+    ++version_;
+  }
+
+  bool RemoveLink(const string &from) {
+    if (links_.erase(from) == 0) {
+      return false;
+    }
+    ++version_;
+    return true;
+  }
+
+  uint64_t version() const { return version_; }
+
+  // The trie for the current links, recompiled after edits.
+  const LinkTrie &Trie() {
+    if (trie_version_ != version_) {
+      trie_ = LinkTrie::Compile(links_);
+      trie_version_ = version_;
+    }
+    return trie_;
+  }
+
+  // Resolution of the normalized `path` under the current links, or nullptr
+  // if it is not cached.
+  const string *Find(const string &path) {
+    auto it = index_.find(path);
+    if (it == index_.end()) {
+      ++misses_;
+      return nullptr;
+    }
+    if (it->second->version != version_) {
+      lru_.erase(it->second);
+      index_.erase(it);
+      ++misses_;
+      return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second); // most recently used
+    ++hits_;
+    return &lru_.front().target;
+  }
 
+  void Insert(const string &path, const string &target) {
+    if (capacity_ == 0) {
+      return;
+    }
+    auto it = index_.find(path);
+    if (it != index_.end()) {
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+    lru_.push_front({path, target, version_});
+    index_[lru_.front().path] = lru_.begin();
+    if (lru_.size() > capacity_) {
+      index_.erase(lru_.back().path);
+      lru_.pop_back();
+    }
+  }
+
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+private:
+  struct Entry {
+    string path, target;
+    uint64_t version;
+  };
+
+  unordered_map<string, string> links_;
+  uint64_t version_ = 0;
+  LinkTrie trie_;
+  uint64_t trie_version_ = 0;
+
+  size_t capacity_;
+  list<Entry> lru_; // front = most recently used
+  // Keys view Entry::path; list nodes never move.
+  unordered_map<string_view, list<Entry>::iterator> index_;
+  size_t hits_ = 0, misses_ = 0;
+};
+
+// Threads kept across batches, so a batch pays no thread start-up. Run(n,
+// fn) calls fn(0) on the caller and fn(1) .. fn(n - 1) on pool threads, and
+// returns once every call has finished. One Run at a time; fn must not
+// throw.
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t num_threads) {
+    for (size_t i = 1; i < num_threads; ++i) {
+      threads_.emplace_back([this] { Loop(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) {
+      t.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // Workers a Run can use, the caller included.
+  size_t size() const { return threads_.size() + 1; }
+
+  void Run(size_t n, const std::function<void(size_t)> &fn) {
+    std::lock_guard<std::mutex> run(run_mtx_);
+    n = std::max<size_t>(std::min(n, size()), 1);
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      job_ = &fn;
+      jobs_ = n;
+      next_ = 1;
+      busy_ = n - 1;
+      ++generation_;
+    }
+    cv_.notify_all();
+    fn(0);
+    std::unique_lock<std::mutex> lock(mtx_);
+    done_cv_.wait(lock, [this] { return busy_ == 0; });
+    job_ = nullptr;
+  }
+
+private:
+  void Loop() {
+    uint64_t seen = 0;
+    while (true) {
+      size_t w;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+        if (next_ == jobs_) {
+          continue; // every call of this Run is taken
+        }
+        w = next_++;
+      }
+      (*job_)(w);
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (--busy_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  vector<std::thread> threads_;
+  std::mutex run_mtx_; // serializes Run
+  std::mutex mtx_;
+  std::condition_variable cv_, done_cv_;
+  const std::function<void(size_t)> *job_ = nullptr;
+  size_t jobs_ = 0, next_ = 0, busy_ = 0;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+};
+
+// Results of FileSystem::cdBatch, packed into a single buffer.
+struct PathBatch {
+  struct Span {
+    size_t offset, size;
+    bool error; // the text is the error message, e.g. "Cyclic Link"
+  };
+  string arena;
+  vector<Span> spans; // one per request, in request order
+  size_t unique = 0;  // distinct requests actually resolved
+
+  size_t size() const { return spans.size(); }
+  string_view operator[](size_t i) const {
+    return string_view(arena).substr(spans[i].offset, spans[i].size);
+  }
+  bool failed(size_t i) const { return spans[i].error; }
+};
+
+// Directory tree with soft links. A link is a directory entry that also
+// carries a target path. Links resolve like FileSystem::cd: the longest link
+// on the path is replaced by its target until none applies, so directories
+// made only to hold a nested link do not hide a link above them.
+class Vfs {
+public:
+  struct Node {
+    Node *parent; // nullptr for "/"
+    uint32_t name;
+    unordered_map<uint32_t, Node *> children; // name id -> child
+    bool is_link = false;
+    vector<uint32_t> target = {}; // link target, as name ids from "/"
+  };
+
+  Vfs() : root_(&nodes_.emplace_back(Node{nullptr, Intern(""), {}})) {}
+  Vfs(const Vfs &) = delete; // nodes point into nodes_
+  Vfs &operator=(const Vfs &) = delete;
+
+  Node *root() { return root_; }
+
+  // `in` relative to `pwd` (ignored for absolute paths and "~"). Returns
+  // nullptr if the path climbs above "/" or a directory does not exist.
+  Node *Cd(Node *pwd, string_view in) { return Walk(pwd, in, false); }
+
+  // Creates every missing directory along `path`; links are followed, so a
+  // directory under a link is created in the link's target.
+  Node *MkdirP(string_view path) { return Walk(root_, path, true); }
+
+  // Makes the absolute path `from` a soft link to the absolute path `to`.
+  // Directories on the way to `from` are created literally, links not
+  // followed, so longer links can nest under shorter ones.
+  void Link(string_view from, string_view to) {
+    if (from.find_first_not_of('/') == string_view::npos) {
+      throw std::runtime_error("Cannot link /");
+    }
+    Node *node = root_;
+    ForEachDir(from, [&](string_view dir) { node = Child(node, Intern(dir)); });
+    node->is_link = true;
+    node->target.clear();
+    ForEachDir(to, [&](string_view dir) { node->target.push_back(Intern(dir)); });
+  }
+
+  // More than `hops` link hops in one walk fails like ELOOP.
+  void SetMaxLinkHops(int hops) { max_link_hops_ = hops; }
+
+  // Sorted entry names of `dir`.
+  vector<string> Ls(const Node *dir) const {
+    vector<string> out;
+    for (auto &[name, child] : dir->children) {
+      out.push_back(names_[name]);
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+  }
+
+  string Path(const Node *node) const {
+    if (node == nullptr) {
+      return "null";
+    }
+    if (node == root_) {
+      return "/";
+    }
+    vector<const Node *> chain;
+    for (; node != root_; node = node->parent) {
+      chain.push_back(node);
+    }
     string out;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      out += "/";
+      out += names_[(*it)->name];
+    }
+    return out;
+  }
+
+private:
+  template <typename Fn> static void ForEachDir(string_view path, Fn fn) {
+    size_t begin = 0;
+    while (begin < path.size()) {
+      size_t end = std::min(path.find('/', begin), path.size());
+      if (end > begin) {
+        fn(path.substr(begin, end - begin));
+      }
+      begin = end + 1;
+    }
+  }
+
+  Node *Walk(Node *start, string_view in, bool create) {
+    // Lexical pass, like PathNormalizer: the components of the absolute
+    // path, "." dropped and ".." cancelling the one before it. Only the
+    // surviving names are looked up, so "nope/.." is fine.
+    vector<string_view> names;
+    if (!in.empty() && in[0] == '~') {
+      names = {"home", "user"};
+      in.remove_prefix(1);
+    } else if (in.empty() || in[0] != '/') {
+      for (Node *n = start; n != root_; n = n->parent) {
+        names.push_back(names_[n->name]);
+      }
+      std::reverse(names.begin(), names.end());
+    }
+    bool above_root = false;
+    ForEachDir(in, [&](string_view dir) {
+      if (dir == ".") {
+        return;
+      }
+      if (dir != "..") {
+        names.push_back(dir);
+      } else if (!names.empty()) {
+        names.pop_back();
+      } else {
+        above_root = true;
+      }
+    });
+    if (above_root) {
+      return nullptr;
+    }
+    vector<uint32_t> path;
+    path.reserve(names.size());
+    for (string_view name : names) {
+      if (create) {
+        path.push_back(Intern(name));
+        continue;
+      }
+      // A name never interned is a child of no directory.
+      auto it = name_ids_.find(name);
+      if (it == name_ids_.end()) {
+        return nullptr;
+      }
+      path.push_back(it->second);
+    }
+
+    // Walk from "/" as far as the directories exist, noting the deepest
+    // link on the way; splice its target over that prefix and start over.
+    for (int hops = 0;; ++hops) {
+      Node *cur = root_, *link = nullptr;
+      size_t depth = 0, link_depth = 0;
+      while (true) {
+        if (cur->is_link) {
+          link = cur;
+          link_depth = depth;
+        }
+        if (depth == path.size()) {
+          break;
+        }
+        auto it = cur->children.find(path[depth]);
+        if (it == cur->children.end()) {
+          break;
+        }
+        cur = it->second;
+        ++depth;
+      }
+      if (link != nullptr) {
+        if (hops == max_link_hops_) {
+          throw std::runtime_error("Cyclic Link");
+        }
+        path.erase(path.begin(), path.begin() + link_depth);
+        path.insert(path.begin(), link->target.begin(), link->target.end());
+        continue;
+      }
+      if (depth < path.size() && !create) {
+        return nullptr;
+      }
+      for (; depth < path.size(); ++depth) {
+        cur = Child(cur, path[depth]);
+      }
+      return cur;
+    }
+  }
+
+  Node *Child(Node *dir, uint32_t name) {
+    auto [it, inserted] = dir->children.try_emplace(name, nullptr);
+    if (inserted) {
+      it->second = &nodes_.emplace_back(Node{dir, name, {}});
+    }
+    return it->second;
+  }
+
+  uint32_t Intern(string_view name) {
+    auto it = name_ids_.find(name);
+    if (it != name_ids_.end()) {
+      return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(names_.size());
+    name_ids_.emplace(names_.emplace_back(name), id);
+    return id;
+  }
+
+  std::deque<Node> nodes_;   // arena: deque never moves its elements
+  std::deque<string> names_; // interned names, viewed by name_ids_
+  unordered_map<string_view, uint32_t> name_ids_;
+  Node *root_;
+  int max_link_hops_ = 40; // like Linux MAXSYMLINKS
+};
+
+class FileSystem {
+public:
+  FileSystem() = default;
+  // soft link map. Assume key and value of each pair is good path - start with
+  // '/' and last dir name ending without '/', like "/foo/bar/openai".
+  // `const &` can bind to temporary values (rvalue), non-const & can't (because
+  // any modification for `softlinks` map will lost after the function if we
+  // pass a temporary rvalue.)
+  // `chain`, if given, receives the path before and after every link hop,
+  // also when resolution fails.
+  string cd(const string &pwd, const string &in,
+            const unordered_map<string, string> &softlinks = {},
+            vector<string> *chain = nullptr) {
+    // /a/b/c, ../d/e = /a/b/d/e
+    if (in.empty()) {
+      return pwd;
+    }
+    string out = Normalized(pwd, in);
+    if (out == "null") {
+      return out;
+    }
     if (!softlinks.empty()) {
       // {/, foo, bar}
       // !! If /folder is linked with /foo/folder_link, then it's not directed.
       // Instead, these two folders can access each other's child dirs and files.
       // I tried in Unix terminal.
-      unordered_set<string> visited;
-      out = Recur(out_list, softlinks, visited);
-    } else {
-      out = CombineDirs(out_list);
+      string key; // reused for every prefix probe
+      ResolveInPlace(
+          out,
+          [&](const string &path, size_t &len) -> const string * {
+            // softlinks only contains absolute paths: probe the prefixes of
+            // `path` from the longest one down.
+            for (size_t end = path.size() > 1 ? path.size() : 0; end > 0;
+                 end = path.rfind('/', end - 1)) {
+              key.assign(path, 0, end);
+              auto itr = softlinks.find(key);
+              if (itr != softlinks.end()) {
+                len = end;
+                return &itr->second;
+              }
+            }
+            return nullptr;
+          },
+          chain);
     }
     return out;
   }
 
-  // DFS + backtracking
-  // time = O(n*k), n is the segment number of initial path (out_list.size()).
-  // k is the number of softlinks.
-  string Recur(vector<string> &out_list,
-               const unordered_map<string, string> &softlinks,
-               unordered_set<string> &visited) {
-    // cout << "Recur out_list size = " << out_list.size() << "\n";
-    bool found_link = false;
-    string out;
-    //   0,   1  , 2
-    //   i         j
-    // {foo, bar, xyz}
-    // time = O(n)
-    for (size_t dir_num = out_list.size(); dir_num > 0; --dir_num) {
-      // softlinks only contains absolute paths, so we have to iterate
-      // different path lengths from the root.
-      size_t lo = 0, hi = lo + dir_num - 1;
-      // [inclusive, exclusive)
-      vector<string> sub_list(out_list.begin(), out_list.begin() + hi + 1);
-      string sub_path = CombineDirs(sub_list);
-      // cout << "Recur sub_path = " << sub_path << "\n";
-      auto itr = softlinks.find(sub_path);
-      // find the link: /foo/bar/xyz -> /openai
-      if (itr != softlinks.end()) {
-        if (visited.count(itr->second)) {
-          throw std::runtime_error("Cyclic Link");
-        }
-        visited.insert(itr->first);
-        found_link = true;
-        vector<string> new_list;
-        vector<string> linked =
-            ExtractDirs(itr->second.substr(1)); // "/xyz/openai"
-        new_list.insert(new_list.end(), linked.begin(), linked.end());
-        new_list.insert(new_list.end(), out_list.begin() + hi + 1,
-                        out_list.end());
-        // At most n times Recur (without cyclic links).
-        out = Recur(new_list, softlinks, visited);
-        visited.erase(itr->first); // erase step
-        break;
-      }
+  // Part 4: same as above against a prebuilt LinkTrie.
+  string cd(const string &pwd, const string &in, const LinkTrie &links,
+            vector<string> *chain = nullptr) {
+    if (in.empty()) {
+      return pwd;
     }
-    if (!found_link) {
-      // base case
-      out = CombineDirs(out_list);
+    string out = Normalized(pwd, in);
+    if (out == "null") {
+      return out;
     }
-    // cout << "out = " << out << "\n";
+    Resolve(out, links, chain);
     return out;
   }
 
-  string CombineDirs(vector<string> &out_list) {
-    if (out_list.empty()) {
-      return "/";
+  // Part 6: resolves through the cache of `links`; only misses walk the trie.
+  string cd(const string &pwd, const string &in, LinkResolver &links) {
+    if (in.empty()) {
+      return pwd;
     }
-    string out;
-    for (size_t i = 0; i < out_list.size(); ++i) {
-      string s = out_list[i];
-      out += "/";
-      out += s;
+    string path = Normalized(pwd, in);
+    if (path == "null") {
+      return path;
+    }
+    if (const string *hit = links.Find(path)) {
+      return *hit;
     }
+    string out = path;
+    Resolve(out, links.Trie());
+    links.Insert(path, out);
     return out;
   }
 
-  vector<string> ExtractDirs(const string &in) {
-    istringstream iss(in);
-    vector<string> ret;
-    string token;
-    while (std::getline(iss, token, '/')) {
-      ret.push_back(token);
+  // Part 7: resolves requests[i] = {pwd, in} against `links` on up to
+  // `num_threads` threads. Paths are normalized like PathNormalizer, and an
+  // error is stored as the result instead of being thrown. The threads are
+  // kept for later batches; one cdBatch at a time per FileSystem.
+  PathBatch cdBatch(const vector<pair<string, string>> &requests,
+                    const LinkTrie &links, size_t num_threads = 0) {
+    struct PairHash {
+      size_t operator()(const pair<string_view, string_view> &p) const {
+        return std::hash<string_view>()(p.first) * 31 +
+               std::hash<string_view>()(p.second);
+      }
+    };
+    // 1. Deduplicate: slot[i] is the index of request i among unique ones.
+    vector<size_t> uniq, slot(requests.size());
+    unordered_map<pair<string_view, string_view>, size_t, PairHash> seen;
+    seen.reserve(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+      auto [it, inserted] = seen.try_emplace(
+          {requests[i].first, requests[i].second}, uniq.size());
+      if (inserted) {
+        uniq.push_back(i);
+      }
+      slot[i] = it->second;
+    }
+
+    // 2. Resolve unique requests. Workers claim chunks from a shared counter
+    //    and append results to their own arena, so they never synchronize.
+    if (num_threads == 0) {
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    constexpr size_t kGrain = 256;
+    num_threads = std::min(num_threads, (uniq.size() + kGrain - 1) / kGrain);
+    num_threads = std::max<size_t>(num_threads, 1);
+    vector<string> arenas(num_threads);
+    vector<pair<size_t, PathBatch::Span>> resolved(uniq.size()); // (worker, span)
+    std::atomic<size_t> next{0};
+    if (!pool_ || pool_->size() < num_threads) {
+      pool_ = std::make_unique<WorkerPool>(num_threads);
+    }
+    pool_->Run(num_threads, [&](size_t w) {
+      PathNormalizer norm;
+      string out;
+      string &arena = arenas[w];
+      size_t begin;
+      while ((begin = next.fetch_add(kGrain)) < uniq.size()) {
+        for (size_t u = begin; u < std::min(begin + kGrain, uniq.size()); ++u) {
+          const auto &[pwd, in] = requests[uniq[u]];
+          string_view path = norm.Normalize(pwd, in);
+          bool error = false;
+          if (!in.empty() && path != "null" && !links.empty()) {
+            out.assign(path);
+            try {
+              Resolve(out, links);
+            } catch (const std::exception &e) {
+              out = e.what();
+              error = true;
+            }
+            path = out;
+          }
+          resolved[u] = {w, {arena.size(), path.size(), error}};
+          arena.append(path);
+        }
+      }
+    });
+
+    // 3. Concatenate the arenas and fan results out to every request.
+    PathBatch batch;
+    vector<size_t> base(num_threads);
+    size_t total = 0;
+    for (size_t w = 0; w < num_threads; ++w) {
+      base[w] = total;
+      total += arenas[w].size();
+    }
+    batch.arena.reserve(total);
+    for (auto &arena : arenas) {
+      batch.arena.append(arena);
+    }
+    batch.spans.resize(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+      auto [w, span] = resolved[slot[i]];
+      span.offset += base[w];
+      batch.spans[i] = span;
+    }
+    batch.unique = uniq.size();
+    return batch;
+  }
+
+  // Absolute form of `in` relative to `pwd`, or "null" if it climbs above
+  // "/". Every cd overload and cdBatch normalize the same way.
+  static string Normalized(const string &pwd, const string &in) {
+    thread_local PathNormalizer norm;
+    return string(norm.Normalize(pwd, in));
+  }
+
+  // Rewrites the normalized absolute `path` in place until no link
+  // applies. find_link(path, len) returns the target of the longest linked
+  // prefix of `path` and sets `len` to its length, or returns nullptr. Each
+  // hop splices the target over that prefix in the same buffer; the walk is
+  // a loop, so long chains cannot exhaust the stack.
+  // A cycle never ends, so more than max_link_hops_ hops fails, like ELOOP.
+  // time = O(h * n), h hops over a path of n characters.
+  template <typename FindLink>
+  void ResolveInPlace(string &path, FindLink find_link,
+                      vector<string> *chain = nullptr) {
+    if (chain) {
+      chain->assign(1, path);
+    }
+    for (int hops = 0;; ++hops) {
+      size_t len = 0;
+      const string *target = find_link(path, len);
+      if (target == nullptr) {
+        return;
+      }
+      if (hops == max_link_hops_) {
+        throw std::runtime_error("Cyclic Link");
+      }
+      path.replace(0, len, *target == "/" ? string_view() : string_view(*target));
+      if (path.empty()) {
+        path = "/";
+      }
+      if (chain) {
+        chain->push_back(path);
+      }
+    }
+  }
+
+  // One trie walk per hop.
+  void Resolve(string &path, const LinkTrie &links,
+               vector<string> *chain = nullptr) {
+    ResolveInPlace(
+        path,
+        [&links](const string &p, size_t &len) -> const string * {
+          int link = links.LongestPrefix(p, len);
+          return link < 0 ? nullptr : &links.Target(link);
+        },
+        chain);
+  }
+
+  // Part 9: hop budget for every resolver above and the tree; Linux
+  // allows 40.
+  void SetMaxLinkHops(int hops) {
+    max_link_hops_ = hops;
+    tree_.SetMaxLinkHops(hops);
+  }
+
+  // Part 8: the directory tree behind cdTree; build it with MkdirP and Link.
+  Vfs &Tree() { return tree_; }
+
+  // Like cd, but against the tree: every directory on the resolved path
+  // must exist, else "null".
+  string cdTree(const string &pwd, const string &in) {
+    string path = Normalized(pwd, in);
+    if (path == "null") {
+      return path;
     }
-    return ret;
+    return tree_.Path(tree_.Cd(tree_.root(), path));
   }
+
+private:
+  int max_link_hops_ = 40;
+  Vfs tree_;
+  std::unique_ptr<WorkerPool> pool_; // cdBatch's threads, grown on demand
 };
 
 int main() {
@@ -238,6 +915,16 @@ int main() {
   cout << fs.cd("/foo/bar", "/") << " [EXPECTED: /]\n";
   cout << fs.cd("/foo/bar", "../xyz////proj") << " [EXPECTED: /foo/xyz/proj]\n";
 
+  cout << "\n====== Allocation-free normalization =======\n";
+  PathNormalizer norm;
+  cout << norm.Normalize("/foo/bar", "../xyz////proj")
+       << " [EXPECTED: /foo/xyz/proj]\n";
+  cout << norm.Normalize("/foo/bar", "/xyz/../../proj") << " [EXPECTED: null]\n";
+  cout << norm.Normalize("/foo/bar", "../..") << " [EXPECTED: /]\n";
+  cout << norm.Normalize("/foo/bar", "~/proj/openai/./..///")
+       << " [EXPECTED: /home/user/proj]\n";
+  cout << norm.Normalize("/foo/../", "./baz") << " [EXPECTED: /baz]\n";
+
   cout << "\n====== User home =======\n";
   cout << fs.cd("/foo/bar", "~") << " [EXPECTED: /home/user]\n";
   cout << fs.cd("/foo/bar", "~/xyz") << " [EXPECTED: /home/user/xyz]\n";
@@ -283,5 +970,173 @@ int main() {
          {"/e", "/z"}}; 
   cout << fs.cd("/a/foo", "./xyz", map) << " [EXPECTED: /z/foo/xyz]\n";
 
+  cout << "\n====== Soft links: cached resolution =======\n";
+  LinkResolver resolver(2);
+  resolver.SetLink("/foo/bar", "/abc");
+  resolver.SetLink("/abc/baz", "/xyz");
+  cout << fs.cd("/foo/bar", "baz", resolver) << " [EXPECTED: /xyz]\n";
+  cout << fs.cd("/foo", "bar/baz", resolver) << " [EXPECTED: /xyz]\n";
+  cout << fs.cd("/foo/bar", "qux", resolver) << " [EXPECTED: /abc/qux]\n";
+  cout << resolver.hits() << " [EXPECTED: 1]\n";
+  resolver.SetLink("/foo/bar/baz", "/direct"); // longer link wins now
+  cout << fs.cd("/foo/bar", "baz", resolver) << " [EXPECTED: /direct]\n";
+  resolver.RemoveLink("/foo/bar");
+  cout << fs.cd("/foo/bar", "qux", resolver) << " [EXPECTED: /foo/bar/qux]\n";
+  cout << resolver.hits() << " [EXPECTED: 1]\n";
+  cout << fs.cd("/foo/bar", "./qux", resolver) << " [EXPECTED: /foo/bar/qux]\n";
+  cout << resolver.hits() << " [EXPECTED: 2]\n";
+
+  cout << "\n====== Soft links: batch resolution =======\n";
+  LinkTrie shared = LinkTrie::Compile({{"/foo/bar/xyz", "/openai/server"},
+                                       {"/openai/server", "/final"},
+                                       {"/home/foo", "/correct_dir"},
+                                       {"/loop", "/loop"}});
+  const vector<pair<string, string>> kinds = {
+      {"/foo/bar", "./xyz"},     {"/home/foo", "../foo/bar/./baz"},
+      {"/", ".."},               {"/tmp", "~/proj"},
+      {"/loop", "a"},            {"/foo/bar", ""}};
+  vector<pair<string, string>> requests;
+  for (int i = 0; i < 60000; ++i) {
+    requests.push_back(kinds[i % kinds.size()]);
+    requests.push_back({"/dir" + std::to_string(i % 5000), "../foo/bar/xyz"});
+  }
+  PathBatch batch = fs.cdBatch(requests, shared, 4);
+  cout << batch.size() << " [EXPECTED: 120000]\n";
+  cout << batch.unique << " [EXPECTED: 5006]\n";
+  for (size_t i = 0; i < kinds.size(); ++i) {
+    cout << (i ? " | " : "") << batch[2 * i]
+         << (batch.failed(2 * i) ? " (error)" : "");
+  }
+  cout << " [EXPECTED: /final | /correct_dir/bar/baz | null | /home/user/proj | "
+          "Cyclic Link (error) | /foo/bar]\n";
+  size_t differ = 0;
+  for (size_t i = 1; i < batch.size(); i += 2) {
+    differ += batch[i] != "/final";
+  }
+  cout << differ << " [EXPECTED: 0]\n";
+  // cd and cdBatch normalize alike, "." and ".." in pwd included.
+  const vector<pair<string, string>> tricky = {
+      {"/foo/../", "./baz"}, {"/foo/./bar/..", "xyz"}, {"/a/b", "../../.."},
+      {"/foo/bar", "~/../x"}, {"/foo/../home/foo", "bar"}};
+  PathBatch agree = fs.cdBatch(tricky, shared, 2);
+  for (size_t i = 0; i < tricky.size(); ++i) {
+    string one;
+    try {
+      one = fs.cd(tricky[i].first, tricky[i].second, shared);
+    } catch (const std::exception &e) {
+      one = e.what();
+    }
+    cout << (i ? " | " : "") << agree[i] << (agree[i] == one ? "" : " (differs)");
+  }
+  cout << " [EXPECTED: /baz | /foo/xyz | null | /home/x | /correct_dir/bar]\n";
+
+  cout << "\n====== Directory tree =======\n";
+  Vfs &vfs = fs.Tree();
+  vfs.MkdirP("/home/user/proj/openai");
+  vfs.MkdirP("/openai/server/node");
+  vfs.MkdirP("/final/logs");
+  vfs.Link("/foo/bar/xyz", "/openai/server");
+  vfs.Link("/openai/server", "/final");
+  vfs.Link("/foo/bar", "/wrong_dir");
+  Vfs::Node *root = vfs.root();
+  cout << vfs.Path(vfs.Cd(root, "/foo/bar/./xyz")) << " [EXPECTED: /final]\n";
+  cout << vfs.Path(vfs.Cd(root, "/foo/bar")) << " [EXPECTED: null]\n";
+  vfs.MkdirP("/foo/bar/tmp"); // through the link: creates /wrong_dir/tmp
+  cout << vfs.Path(vfs.Cd(root, "/foo/bar")) << " [EXPECTED: /wrong_dir]\n";
+  Vfs::Node *home = vfs.Cd(root, "~");
+  cout << vfs.Path(vfs.Cd(home, "proj/../../user/proj/openai"))
+       << " [EXPECTED: /home/user/proj/openai]\n";
+  cout << vfs.Path(vfs.Cd(home, "../../..")) << " [EXPECTED: null]\n";
+  cout << vfs.Path(vfs.Cd(home, "nope")) << " [EXPECTED: null]\n";
+  cout << vfs.Path(vfs.Cd(home, "nope/../proj")) << " [EXPECTED: /home/user/proj]\n";
+  string listing;
+  for (auto &name : vfs.Ls(root)) {
+    listing += (listing.empty() ? "" : " ") + name;
+  }
+  cout << listing << " [EXPECTED: final foo home openai wrong_dir]\n";
+  vfs.MkdirP("/final/logs/2024/jan");
+  cout << vfs.Ls(vfs.Cd(root, "/foo/bar/xyz/logs")).front() << " [EXPECTED: 2024]\n";
+  vfs.Link("/a", "/b");
+  vfs.Link("/b", "/a");
+  try {
+    vfs.Cd(root, "/a/x");
+  } catch (const std::exception &e) {
+    cerr << e.what() << " [EXPECTED: Cyclic Link]\n";
+  }
+  // The longest link wins, as in cd: /p/e exists only to hold /p/e/f.
+  vfs.MkdirP("/q/e");
+  vfs.MkdirP("/x");
+  vfs.Link("/p", "/q");
+  vfs.Link("/p/e/f", "/x");
+  cout << vfs.Path(vfs.Cd(root, "/p/e")) << " | "
+       << fs.cd("/", "/p/e", {{"/p", "/q"}, {"/p/e/f", "/x"}})
+       << " [EXPECTED: /q/e | /q/e]\n";
+  cout << fs.cdTree("/p/e", "f") << " [EXPECTED: /x]\n";
+  cout << fs.cdTree("/foo/../p", "nope") << " [EXPECTED: null]\n";
+  fs.SetMaxLinkHops(1); // /foo/bar/xyz -> /openai/server -> /final
+  try {
+    cout << fs.cdTree("/", "/foo/bar/xyz") << "\n";
+  } catch (const std::exception &e) {
+    cerr << e.what() << " [EXPECTED: Cyclic Link]\n";
+  }
+  fs.SetMaxLinkHops(40);
+  cout << fs.cdTree("/", "/foo/bar/xyz") << " [EXPECTED: /final]\n";
+  try {
+    vfs.Link("/", "/x");
+  } catch (const std::exception &e) {
+    cerr << e.what() << " [EXPECTED: Cannot link /]\n";
+  }
+
+  cout << "\n====== Soft links: hop budget and chain =======\n";
+  unordered_map<string, string> long_chain;
+  for (int i = 0; i < 100; ++i) {
+    long_chain["/l" + std::to_string(i)] = "/l" + std::to_string(i + 1);
+  }
+  try {
+    cout << fs.cd("/", "l0/x", long_chain) << "\n";
+  } catch (const std::exception &e) {
+    cerr << e.what() << " [EXPECTED: Cyclic Link]\n";
+  }
+  fs.SetMaxLinkHops(100);
+  cout << fs.cd("/", "l0/x", long_chain) << " [EXPECTED: /l100/x]\n";
+  fs.SetMaxLinkHops(40);
+  vector<string> chain_log;
+  fs.cd("/foo/bar", "./xyz",
+        {{"/foo/bar/xyz", "/openai/server"}, {"/openai", "/srv"}}, &chain_log);
+  string hops;
+  for (auto &step : chain_log) {
+    hops += (hops.empty() ? "" : " -> ") + step;
+  }
+  cout << hops
+       << " [EXPECTED: /foo/bar/xyz -> /openai/server -> /srv/server]\n";
+  try {
+    fs.cd("/", "a", {{"/a", "/b"}, {"/b", "/a"}}, &chain_log);
+  } catch (const std::exception &e) {
+    cerr << e.what() << " after " << chain_log.size() - 1
+         << " hops [EXPECTED: Cyclic Link after 40 hops]\n";
+  }
+
+  cout << "\n====== Soft links: compiled once =======\n";
+  LinkTrie chain = LinkTrie::Compile(map);
+  for (int i = 0; i < 3; ++i) {
+    cout << fs.cd("/a/foo", "./xyz", chain) << " [EXPECTED: /z/foo/xyz]\n";
+  }
+  LinkTrie links = LinkTrie::Compile({{"/foo/bar/xyz", "/openai/server/node/index"},
+                                      {"/home/foo", "/correct_dir"},
+                                      {"/correct_dir/bar/xyz", "/final"},
+                                      {"/openai/server", "/wrong"}});
+  cout << fs.cd("/home/foo/bar", "./xyz", links) << " [EXPECTED: /final]\n";
+  cout << fs.cd("/foo", "bar/xyz/../xyz/a", links)
+       << " [EXPECTED: /wrong/node/index/a]\n";
+  cout << fs.cd("/", "..", links) << " [EXPECTED: null]\n";
+  try {
+    LinkTrie cyclic = LinkTrie::Compile({{"/home/foo/bar", "/openai"},
+                                         {"/openai", "/test"},
+                                         {"/test", "/home/foo/bar"}});
+    cout << fs.cd("/home/foo/bar", "./xyz", cyclic) << "\n";
+  } catch (const std::exception &e) {
+    cerr << e.what() << " [EXPECTED: Cyclic Link]\n";
+  }
+
   return 0;
 }
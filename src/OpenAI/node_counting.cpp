@@ -1,8 +1,16 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <queue>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -58,9 +66,31 @@ using namespace std;
  *      - Node 4 and Node 5 are children of Node 2
  *      - Node 6 and Node 7 are children of Node 3
  *    - The serialization must be efficient and clear.
+ *
+ * ----------------------------------------------------------------------
+ *
+ * Part 4: Asynchronous Transport
+ *    - SendMessage is a blocking call and every COUNT blocks a thread per
+ * level. Deliver messages asynchronously instead: each node has a mailbox,
+ * a fixed pool of workers runs nodes with mail, and a node answers its
+ * parent once the last child has replied (no thread waits on a child).
+ *    - COUNT and TOPO on a 100k-node tree take O(depth) rounds on a few
+ * threads.
+ *
+ * ----------------------------------------------------------------------
+ *
+ * Part 5: Lossy Network
+ *    - Links drop, delay and duplicate messages. A parent that hears
+ * nothing from a kid within a timeout resends the request, backing off
+ * exponentially, and gives up after a few unanswered attempts.
+ *    - A repeated request is answered from reqs_done_ instead of being
+ * counted again. A kid that is still waiting on its own subtree answers
+ * "BUSY", which tells the parent to keep waiting.
+ *    - Benchmark COUNT latency and message amplification under loss.
  */
 
 class Node;
+class Runtime;
 // SendMessage implementation to simulate message passing
 string SendMessage(int from, int to_node_id, const string &message,
                    string req_id = "");
@@ -68,6 +98,186 @@ string SendMessage(int from, int to_node_id, const string &message,
 // Global registry to store node mappings
 unordered_map<int, Node *> node_registry;
 
+// Part 4: one message between nodes, or between a node and the client
+// (node id -1). A reply carries the result for the request `req_id`.
+struct Message {
+  int from;
+  int to;
+  string msg; // "COUNT" or "TOPO"
+  string req_id;
+  bool reply = false;
+  string payload = {}; // reply: the count or the topology
+  size_t slot = 0; // the child's position among its parent's kids
+  int attempt = 0; // "TIMEOUT": which send of the request timed out
+};
+
+// Part 5: fires callbacks at deadlines on one background thread.
+class Timer {
+public:
+  Timer() : thread_([this] { Run(); }) {}
+
+  ~Timer() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_ = true; // events still queued are dropped
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  void After(std::chrono::microseconds delay, std::function<void()> fn) {
+    bool earliest;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      auto at = std::chrono::steady_clock::now() + delay;
+      earliest = events_.empty() || at < events_.top().at;
+      events_.push({at, seq_++, std::move(fn)});
+    }
+    if (earliest) { // otherwise the thread already wakes up in time
+      cv_.notify_one();
+    }
+  }
+
+private:
+  struct Event {
+    std::chrono::steady_clock::time_point at;
+    uint64_t seq; // FIFO among equal deadlines
+    std::function<void()> fn;
+    bool operator>(const Event &other) const {
+      return at != other.at ? at > other.at : seq > other.seq;
+    }
+  };
+
+  void Run() {
+    vector<std::function<void()>> due;
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+      auto now = std::chrono::steady_clock::now();
+      while (!events_.empty() && events_.top().at <= now) {
+        due.push_back(events_.top().fn);
+        events_.pop();
+      }
+      if (!due.empty()) { // fire everything due under one lock round trip
+        lock.unlock();
+        for (auto &fn : due) {
+          fn();
+        }
+        due.clear();
+        lock.lock();
+      } else if (events_.empty()) {
+        cv_.wait(lock);
+      } else {
+        auto next = events_.top().at; // a copy: top() moves as others push
+        cv_.wait_until(lock, next);
+      }
+    }
+  }
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::priority_queue<Event, vector<Event>, std::greater<Event>> events_;
+  uint64_t seq_ = 0;
+  bool stop_ = false;
+  std::thread thread_; // last: starts once the rest is constructed
+};
+
+// Part 5: carries node-to-node messages for the Runtime. `deliver` puts a
+// message into its mailbox; a network may call it late, twice or never.
+class Network {
+public:
+  virtual ~Network() = default;
+  virtual void Transmit(Message m, std::function<void(Message)> deliver) = 0;
+};
+
+// Drops each message with probability drop_rate, otherwise delivers it
+// after latency + an exponentially distributed jitter (mean `jitter`),
+// and with probability dup_rate delivers a second, independently delayed
+// copy.
+class LossyNetwork : public Network {
+public:
+  struct Config {
+    double drop_rate = 0;
+    double dup_rate = 0;
+    std::chrono::microseconds latency{0};
+    std::chrono::microseconds jitter{0};
+    uint64_t seed = 1;
+  };
+
+  struct Stats {
+    size_t sent = 0;
+    size_t dropped = 0;
+    size_t duplicated = 0;
+  };
+
+  explicit LossyNetwork(const Config &config)
+      : config_(config), rng_(config.seed) {}
+
+  void Transmit(Message m, std::function<void(Message)> deliver) override {
+    std::chrono::microseconds delays[2];
+    int copies;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      ++stats_.sent;
+      if (Roll(config_.drop_rate)) {
+        ++stats_.dropped;
+        return;
+      }
+      copies = Roll(config_.dup_rate) ? 2 : 1;
+      stats_.duplicated += copies - 1;
+      for (int i = 0; i < copies; ++i) {
+        delays[i] = config_.latency + Jitter();
+      }
+    }
+    for (int i = 0; i < copies; ++i) {
+      timer_.After(delays[i], [deliver, m] { deliver(m); });
+    }
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return stats_;
+  }
+
+private:
+  bool Roll(double p) {
+    return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < p;
+  }
+
+  std::chrono::microseconds Jitter() {
+    if (config_.jitter.count() <= 0) {
+      return std::chrono::microseconds(0);
+    }
+    std::exponential_distribution<double> d(1.0 / config_.jitter.count());
+    return std::chrono::microseconds(static_cast<int64_t>(d(rng_)));
+  }
+
+  Config config_;
+  mutable std::mutex mtx_; // guards rng_ and stats_
+  std::mt19937_64 rng_;
+  Stats stats_;
+  Timer timer_; // last: destroyed first, so no delivery outlives the rest
+};
+
+// Part 5: how a parent retries a kid. Attempt n waits
+// min(timeout * backoff^(n-1), max_timeout); after max_attempts sends in a
+// row without any answer the kid counts as lost and the request fails with
+// "ERROR". max_attempts == 0 turns retries off.
+struct RetryPolicy {
+  std::chrono::microseconds timeout{0};
+  double backoff = 2;
+  std::chrono::microseconds max_timeout{0};
+  int max_attempts = 0;
+
+  std::chrono::microseconds Timeout(int attempt) const {
+    double t = timeout.count();
+    for (int i = 1; i < attempt && t < max_timeout.count(); ++i) {
+      t *= backoff;
+    }
+    return std::chrono::microseconds(
+        static_cast<int64_t>(std::min<double>(t, max_timeout.count())));
+  }
+};
+
 class Node {
 public:
   Node() = default;
@@ -136,6 +346,25 @@ public:
     return ret;
   }
 
+  // Part 4: handles one message delivered by the Runtime. A node's messages
+  // are handled one at a time, so its state needs no lock here.
+  void Receive(Runtime &rt, const Message &m);
+
+  // Part 4: a request waiting for replies from the kids.
+  struct Pending {
+    int parent;
+    size_t slot; // our position among the parent's kids
+    size_t remaining;
+    int sum;
+    vector<string> parts; // TOPO: one per kid
+    // Part 5: per kid.
+    vector<char> replied;
+    vector<int> tries;      // sends so far; numbers the TIMEOUT messages
+    vector<int> unanswered; // sends that timed out in silence
+    vector<char> busy;      // the kid said BUSY: alive, working on its subtree
+    vector<std::chrono::steady_clock::time_point> due; // latest send's timeout
+  };
+
   // omit getter and setter functions.
   vector<Node *> kids_;
   int id_;
@@ -143,6 +372,17 @@ public:
   std::mutex mtx_;
   int req_counter_; // mutex for thread safe.
   unordered_set<string> reqs_done_;
+  unordered_map<string, Pending> pending_; // req_id -> waiting request
+  unordered_map<string, string> replies_;  // req_id in reqs_done_ -> reply
+
+private:
+  // Part 5: sends request `msg` to kid `i`, and arms its timeout.
+  void SendToKid(Runtime &rt, Pending &p, const string &msg,
+                 const string &req_id, size_t i);
+  void OnTimeout(Runtime &rt, const Message &m);
+  // Records the reply for `req_id` in reqs_done_ and sends it to `parent`.
+  void Finish(Runtime &rt, const string &msg, const string &req_id,
+              int parent, size_t slot, string result);
 };
 
 string SendMessage(int from, int to_node_id, const string &message,
@@ -155,6 +395,296 @@ string SendMessage(int from, int to_node_id, const string &message,
   return "";
 }
 
+// Part 4: delivers Messages asynchronously. Every registered node gets a
+// mailbox; a node with mail is queued once on the run queue, and a fixed
+// pool of workers takes nodes off it and drains their mailboxes. A node is
+// never run by two workers at once.
+class Runtime {
+public:
+  // Node-to-node messages go through `network` when one is given, and
+  // parents retry lost ones according to `policy`.
+  explicit Runtime(size_t num_workers = std::thread::hardware_concurrency(),
+                   std::unique_ptr<Network> network = nullptr,
+                   const RetryPolicy &policy = {})
+      : network_(std::move(network)), policy_(policy) {
+    for (auto &[id, node] : node_registry) {
+      mailboxes_[id].node = node; // the topology is fixed from here on
+    }
+    for (size_t i = 0; i < std::max<size_t>(num_workers, 1); ++i) {
+      workers_.emplace_back([this] { Work(); });
+    }
+  }
+
+  // Mail not yet handled and messages in flight are dropped.
+  ~Runtime() {
+    {
+      std::lock_guard<std::mutex> lock(run_mtx_);
+      stop_ = true;
+    }
+    run_cv_.notify_all();
+    for (auto &w : workers_) {
+      w.join();
+    }
+    // Nothing calls Post now; the network and timer may still Deliver.
+    network_.reset();
+    timer_.reset();
+  }
+
+  Runtime(const Runtime &) = delete;
+  Runtime &operator=(const Runtime &) = delete;
+
+  // Starts a COUNT or TOPO at `root`; the future gets the root's reply.
+  std::future<string> Request(int root, const string &msg) {
+    string req_id = msg + std::to_string(++req_counter_);
+    std::future<string> result;
+    {
+      std::lock_guard<std::mutex> lock(clients_mtx_);
+      result = clients_[req_id].get_future();
+    }
+    Post({-1, root, msg, req_id});
+    return result;
+  }
+
+  // Queues `m` in the mailbox of m.to and returns at once. A message to
+  // the client (-1) completes its Request; one to an unknown node is lost.
+  // Messages between two nodes cross the network, if there is one.
+  void Post(Message m) {
+    messages_.fetch_add(1, std::memory_order_relaxed);
+    if (network_ && m.from != -1 && m.to != -1) {
+      network_->Transmit(std::move(m), [this](Message m) { Deliver(std::move(m)); });
+      return;
+    }
+    Deliver(std::move(m));
+  }
+
+  // Delivers `m` to its own node after `delay`, off the network.
+  void PostAfter(std::chrono::microseconds delay, Message m) {
+    timer_->After(delay, [this, m] { Deliver(m); });
+  }
+
+  const RetryPolicy &policy() const { return policy_; }
+  Network *network() const { return network_.get(); }
+
+  // Messages posted so far, client traffic included.
+  size_t messages() const { return messages_.load(std::memory_order_relaxed); }
+
+private:
+  void Deliver(Message m) {
+    if (m.to == -1) {
+      std::promise<string> done;
+      {
+        std::lock_guard<std::mutex> lock(clients_mtx_);
+        auto itr = clients_.find(m.req_id);
+        if (itr == clients_.end()) {
+          return; // a duplicate reply
+        }
+        done = std::move(itr->second);
+        clients_.erase(itr);
+      }
+      done.set_value(std::move(m.payload));
+      return;
+    }
+    auto itr = mailboxes_.find(m.to);
+    if (itr == mailboxes_.end()) {
+      return;
+    }
+    Mailbox &box = itr->second;
+    bool schedule;
+    {
+      std::lock_guard<std::mutex> lock(box.mtx);
+      box.queue.push_back(std::move(m));
+      schedule = !box.scheduled;
+      box.scheduled = true;
+    }
+    if (schedule) {
+      Schedule(&box);
+    }
+  }
+
+  struct Mailbox {
+    Node *node = nullptr;
+    std::mutex mtx;
+    std::deque<Message> queue;
+    bool scheduled = false; // on the run queue or being drained
+  };
+
+  // Messages a worker handles for one node before letting others run.
+  static constexpr size_t kBatch = 64;
+
+  void Schedule(Mailbox *box) {
+    {
+      std::lock_guard<std::mutex> lock(run_mtx_);
+      run_queue_.push_back(box);
+    }
+    run_cv_.notify_one();
+  }
+
+  void Work() {
+    while (true) {
+      Mailbox *box;
+      {
+        std::unique_lock<std::mutex> lock(run_mtx_);
+        run_cv_.wait(lock, [this] { return stop_ || !run_queue_.empty(); });
+        if (stop_) {
+          return;
+        }
+        box = run_queue_.front();
+        run_queue_.pop_front();
+      }
+      std::deque<Message> batch;
+      {
+        std::lock_guard<std::mutex> lock(box->mtx);
+        for (size_t i = 0; i < kBatch && !box->queue.empty(); ++i) {
+          batch.push_back(std::move(box->queue.front()));
+          box->queue.pop_front();
+        }
+      }
+      for (const Message &m : batch) {
+        box->node->Receive(*this, m);
+      }
+      bool more;
+      {
+        std::lock_guard<std::mutex> lock(box->mtx);
+        more = !box->queue.empty();
+        box->scheduled = more;
+      }
+      if (more) {
+        Schedule(box);
+      }
+    }
+  }
+
+  unordered_map<int, Mailbox> mailboxes_; // read-only after construction
+  std::mutex run_mtx_;
+  std::condition_variable run_cv_;
+  std::deque<Mailbox *> run_queue_;
+  bool stop_ = false;
+  vector<std::thread> workers_;
+
+  std::mutex clients_mtx_;
+  unordered_map<string, std::promise<string>> clients_; // req_id -> caller
+  static inline std::atomic<int> req_counter_{0}; // ids stay unique across runtimes
+  std::atomic<size_t> messages_{0};
+
+  std::unique_ptr<Network> network_;
+  RetryPolicy policy_;
+  std::unique_ptr<Timer> timer_ = std::make_unique<Timer>();
+};
+
+void Node::Receive(Runtime &rt, const Message &m) {
+  if (m.msg == "TIMEOUT") {
+    OnTimeout(rt, m);
+    return;
+  }
+  if (!m.reply) {
+    if (reqs_done_.count(m.req_id)) {
+      // Part 2: a retry or a copy of a request we answered; resend, since
+      // the first answer may have been lost, and do not count again.
+      rt.Post({id_, m.from, m.msg, m.req_id, true, replies_[m.req_id], m.slot});
+      return;
+    }
+    if (pending_.count(m.req_id)) {
+      rt.Post({id_, m.from, m.msg, m.req_id, true, "BUSY", m.slot});
+      return;
+    }
+    if (kids_.empty()) {
+      Finish(rt, m.msg, m.req_id, m.from, m.slot,
+             m.msg == "COUNT" ? "1" : std::to_string(id_));
+      return;
+    }
+    // Fan out and remember who to answer; the replies finish the request.
+    size_t n = kids_.size();
+    Pending &p = pending_[m.req_id] = {
+        m.from, m.slot,           n, 1, vector<string>(m.msg == "TOPO" ? n : 0),
+        vector<char>(n),          vector<int>(n), vector<int>(n),
+        vector<char>(n),          vector<std::chrono::steady_clock::time_point>(n)};
+    for (size_t i = 0; i < n; ++i) {
+      SendToKid(rt, p, m.msg, m.req_id, i);
+    }
+    return;
+  }
+  auto itr = pending_.find(m.req_id);
+  if (itr == pending_.end() || itr->second.replied[m.slot]) {
+    return; // late or duplicated reply
+  }
+  Pending &p = itr->second;
+  if (m.payload == "BUSY") {
+    p.busy[m.slot] = 1; // alive; its own timeouts bound its subtree
+    return;
+  }
+  if (m.payload == "ERROR") {
+    Finish(rt, m.msg, m.req_id, p.parent, p.slot, "ERROR");
+    pending_.erase(itr);
+    return;
+  }
+  p.replied[m.slot] = 1;
+  if (m.msg == "COUNT") {
+    p.sum += std::stoi(m.payload);
+  } else {
+    p.parts[m.slot] = m.payload;
+  }
+  if (--p.remaining > 0) {
+    return;
+  }
+  string result;
+  if (m.msg == "COUNT") {
+    cached_node_count_ = p.sum;
+    result = std::to_string(p.sum);
+  } else {
+    result = std::to_string(id_) + "[";
+    for (size_t i = 0; i < p.parts.size(); ++i) {
+      result += (i ? "," : "") + p.parts[i];
+    }
+    result += "]";
+  }
+  Finish(rt, m.msg, m.req_id, p.parent, p.slot, std::move(result));
+  pending_.erase(itr);
+}
+
+void Node::SendToKid(Runtime &rt, Pending &p, const string &msg,
+                     const string &req_id, size_t i) {
+  int attempt = ++p.tries[i];
+  ++p.unanswered[i];
+  rt.Post({id_, kids_[i]->id_, msg, req_id, false, "", i});
+  if (rt.policy().max_attempts > 0) {
+    auto timeout = rt.policy().Timeout(attempt);
+    p.due[i] = std::chrono::steady_clock::now() + timeout;
+    // The request name rides in payload so the timeout can resend it.
+    rt.PostAfter(timeout, {id_, id_, "TIMEOUT", req_id, false, msg, i, attempt});
+  }
+}
+
+void Node::OnTimeout(Runtime &rt, const Message &m) {
+  auto itr = pending_.find(m.req_id);
+  if (itr == pending_.end()) {
+    return;
+  }
+  Pending &p = itr->second;
+  if (p.replied[m.slot] || p.tries[m.slot] != m.attempt) {
+    return; // answered, or a newer send has its own timeout
+  }
+  // Only silence counts toward giving up. A kid that said BUSY is still
+  // resent to, in case its reply was lost, but never given up on; and a
+  // timeout handled a whole period late means this node stalled, not the kid.
+  auto late = std::chrono::steady_clock::now() - p.due[m.slot];
+  if (p.busy[m.slot] || late > rt.policy().Timeout(m.attempt)) {
+    --p.unanswered[m.slot];
+  }
+  if (p.unanswered[m.slot] < rt.policy().max_attempts) {
+    SendToKid(rt, p, m.payload, m.req_id, m.slot);
+    return;
+  }
+  Finish(rt, m.payload, m.req_id, p.parent, p.slot, "ERROR");
+  pending_.erase(itr);
+}
+
+void Node::Finish(Runtime &rt, const string &msg, const string &req_id,
+                  int parent, size_t slot, string result) {
+  reqs_done_.insert(req_id);
+  replies_[req_id] = result;
+  rt.Post({id_, parent, msg, req_id, true, std::move(result), slot});
+}
+
 int main() {
   /* Idempotent
      1
@@ -183,5 +713,99 @@ int main() {
   // cout << "\n Idempotent \n";
   cout << SendMessage(-1, 0, "COUNT") << " [EXPECTED: 8]\n";
 
+  cout << "\n Async runtime \n";
+  // 100k nodes, 4 kids each, ids from 100000 so they miss the tree above.
+  constexpr int kBase = 100000, kNodes = 100000;
+  std::deque<Node> cluster; // Node holds a mutex, so it cannot move
+  for (int i = 0; i < kNodes; ++i) {
+    cluster.emplace_back(kBase + i);
+  }
+  for (int i = 1; i < kNodes; ++i) {
+    cluster[(i - 1) / 4].kids_.push_back(&cluster[i]);
+  }
+  {
+    Runtime rt(4);
+    auto start = std::chrono::steady_clock::now();
+    std::future<string> count = rt.Request(kBase, "COUNT");
+    std::future<string> topo = rt.Request(kBase, "TOPO");
+    string n = count.get();
+    string t = topo.get();
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    cout << n << " [EXPECTED: 100000]\n";
+    cout << t.substr(0, 27) << " [EXPECTED: 100000[100001[100005[100021]\n";
+    cout << std::count(t.begin(), t.end(), ',') << " [EXPECTED: 74999]\n";
+    // Each request crosses every edge twice, plus the client's two messages.
+    cout << rt.messages() << " [EXPECTED: 400000]\n";
+    cout << rt.Request(0, "TOPO").get() << " [EXPECTED: 0[1[3,4],2[5[7],6]]]\n";
+    cout << rt.Request(7, "COUNT").get() << " [EXPECTED: 1]\n";
+    cout << "COUNT + TOPO on " << kNodes << " nodes, 4 workers: " << ms
+         << " ms\n";
+  }
+
+  cout << "\n Lossy network \n";
+  // 1365 nodes, 4 kids each (5 levels below the root); links take
+  // 200us + ~100us jitter. Timeouts must cover a kid's whole subtree, or
+  // parents spend messages probing kids that are merely busy.
+  constexpr int kLossyBase = 200000, kLossyNodes = 1365, kRuns = 5;
+  std::deque<Node> lossy;
+  for (int i = 0; i < kLossyNodes; ++i) {
+    lossy.emplace_back(kLossyBase + i);
+  }
+  for (int i = 1; i < kLossyNodes; ++i) {
+    lossy[(i - 1) / 4].kids_.push_back(&lossy[i]);
+  }
+  vector<pair<string, RetryPolicy>> policies = {
+      {"fixed 5ms", {std::chrono::milliseconds(5), 1,
+                     std::chrono::milliseconds(5), 8}},
+      {"backoff 5-80ms", {std::chrono::milliseconds(5), 2,
+                          std::chrono::milliseconds(80), 8}}};
+  // Without loss a COUNT takes one request and one reply per edge.
+  const double ideal = 2.0 * kLossyNodes;
+  for (const auto &[name, policy] : policies) {
+    for (double drop : {0.0, 0.01, 0.05, 0.10}) {
+      LossyNetwork::Config config;
+      config.drop_rate = drop;
+      config.dup_rate = 0.01;
+      config.latency = std::chrono::microseconds(200);
+      config.jitter = std::chrono::microseconds(100);
+      Runtime rt(4, std::make_unique<LossyNetwork>(config), policy);
+      // A COUNT either is exact or fails with ERROR when a kid stays silent
+      // for max_attempts sends; retries and copies never change the sum.
+      // Without loss every kid answers, so a COUNT never fails.
+      int wrong = 0, failed = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int run = 0; run < kRuns; ++run) {
+        string n = rt.Request(kLossyBase, "COUNT").get();
+        failed += n == "ERROR";
+        wrong += n != "ERROR" && n != std::to_string(kLossyNodes);
+      }
+      double ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      auto *net = static_cast<LossyNetwork *>(rt.network());
+      LossyNetwork::Stats st = net->stats();
+      cout << name << ", drop " << drop * 100 << "%: wrong = " << wrong
+           << " [EXPECTED: 0]\n";
+      cout << "  COUNT " << ms / kRuns << " ms, amplification "
+           << rt.messages() / (ideal * kRuns) << "x, failed " << failed << "/"
+           << kRuns << ", dropped " << st.dropped << ", duplicated "
+           << st.duplicated << "\n";
+      if (drop == 0) {
+        cout << "  failed = " << failed << " [EXPECTED: 0]\n";
+      }
+    }
+  }
+  // Every link down: the root's kids are never heard from and it gives up.
+  {
+    LossyNetwork::Config config;
+    config.drop_rate = 1;
+    Runtime rt(2, std::make_unique<LossyNetwork>(config),
+               {std::chrono::microseconds(200), 2,
+                std::chrono::milliseconds(1), 3});
+    cout << rt.Request(0, "COUNT").get() << " [EXPECTED: ERROR]\n";
+  }
+
   return 0;
 }
@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -8,7 +12,10 @@
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
 #include <chrono>
 
 using namespace std;
@@ -252,7 +259,163 @@ public:
     }
   }
 
+  /*
+  Snapshot format: fixed-width little-endian integers plus a key-offset table,
+  so every key record can be located without parsing the ones before it.
+
+    "TMS1" | u64 key_count | u64 offsets[key_count] | records...
+    record: u32 key_len | key | u64 entry_count | (i32 ts | u32 val_len | val)*
+
+  Offsets are relative to the start of the records section.
+  */
+  string SerializeSnapshot() {
+    cout << "--- SerializeSnapshot ---\n";
+    string records;
+    vector<uint64_t> offsets;
+    offsets.reserve(store_.size());
+    for (auto &[key, val_list] : store_) {
+      offsets.push_back(records.size());
+      PutInt<uint32_t>(records, key.size());
+      records.append(key);
+      PutInt<uint64_t>(records, val_list.size());
+      for (auto &[ts, val] : val_list) {
+        PutInt<int32_t>(records, ts);
+        PutInt<uint32_t>(records, val.size());
+        records.append(val);
+      }
+    }
+
+    string blob(kSnapshotMagic, sizeof(kSnapshotMagic));
+    blob.reserve(blob.size() + 8 * (offsets.size() + 1) + records.size());
+    PutInt<uint64_t>(blob, offsets.size());
+    for (uint64_t off : offsets) {
+      PutInt<uint64_t>(blob, off);
+    }
+    blob.append(records);
+    return blob;
+  }
+
+  // Decodes disjoint key ranges on `num_threads` workers. Each series is
+  // bulk-built from already-sorted entries with an end hint, so the map never
+  // searches for the insert position.
+  void DeserializeSnapshot(const string &blob, size_t num_threads = 0) {
+    cout << "--- DeserializeSnapshot ---\n";
+    if (blob.size() < sizeof(kSnapshotMagic) + 8 ||
+        blob.compare(0, sizeof(kSnapshotMagic), kSnapshotMagic,
+                     sizeof(kSnapshotMagic)) != 0) {
+      throw std::runtime_error("Bad snapshot header");
+    }
+    size_t pos = sizeof(kSnapshotMagic);
+    uint64_t key_count = GetInt<uint64_t>(blob, pos);
+    if (key_count > (blob.size() - pos) / 8) {
+      throw std::runtime_error("Invalid key count");
+    }
+    const size_t table_pos = pos;
+    const size_t records_pos = table_pos + key_count * 8;
+
+    using Series = pair<string, map<int, string>>;
+    vector<Series> decoded(key_count);
+    auto decode_range = [&](size_t begin, size_t end) {
+      for (size_t ki = begin; ki < end; ++ki) {
+        size_t off_pos = table_pos + ki * 8;
+        uint64_t off = GetInt<uint64_t>(blob, off_pos);
+        if (off > blob.size() - records_pos) {
+          throw std::runtime_error("Invalid key offset");
+        }
+        size_t p = records_pos + off;
+        uint32_t key_len = GetInt<uint32_t>(blob, p);
+        CheckAvailable(blob, p, key_len);
+        decoded[ki].first.assign(blob, p, key_len);
+        p += key_len;
+
+        uint64_t entry_count = GetInt<uint64_t>(blob, p);
+        if (entry_count == 0) { // never written: a key has at least one value
+          throw std::runtime_error("Invalid entry count");
+        }
+        auto &series = decoded[ki].second;
+        int prev_ts = 0;
+        for (uint64_t ei = 0; ei < entry_count; ++ei) {
+          int32_t ts = GetInt<int32_t>(blob, p);
+          if (ei > 0 && ts <= prev_ts) {
+            throw std::runtime_error("Timestamps out of order");
+          }
+          prev_ts = ts;
+          uint32_t val_len = GetInt<uint32_t>(blob, p);
+          CheckAvailable(blob, p, val_len);
+          series.emplace_hint(series.end(), ts, string(blob, p, val_len));
+          p += val_len;
+        }
+      }
+    };
+
+    if (num_threads == 0) {
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min<size_t>(num_threads, std::max<uint64_t>(1, key_count));
+    size_t chunk = (key_count + num_threads - 1) / num_threads;
+    vector<std::exception_ptr> errors(num_threads);
+    vector<std::thread> workers;
+    for (size_t t = 1; t < num_threads; ++t) {
+      size_t begin = std::min<size_t>(t * chunk, key_count);
+      size_t end = std::min<size_t>(begin + chunk, key_count);
+      workers.emplace_back([&, t, begin, end]() {
+        try {
+          decode_range(begin, end);
+        } catch (...) {
+          errors[t] = std::current_exception();
+        }
+      });
+    }
+    try {
+      decode_range(0, std::min<size_t>(chunk, key_count));
+    } catch (...) {
+      errors[0] = std::current_exception();
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+    for (auto &e : errors) {
+      if (e) {
+        std::rethrow_exception(e);
+      }
+    }
+
+    // Only commit once the whole snapshot decoded cleanly.
+    store_.clear();
+    store_.reserve(key_count);
+    for (auto &[key, series] : decoded) {
+      store_.insert_or_assign(std::move(key), std::move(series));
+    }
+  }
+
 private:
+  static constexpr char kSnapshotMagic[4] = {'T', 'M', 'S', '1'};
+
+  template <typename T> static void PutInt(string &out, T v) {
+    auto u = static_cast<std::make_unsigned_t<T>>(v);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      out.push_back(static_cast<char>((u >> (8 * i)) & 0xff));
+    }
+  }
+
+  template <typename T> static T GetInt(const string &in, size_t &pos) {
+    CheckAvailable(in, pos, sizeof(T));
+    std::make_unsigned_t<T> u = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      u |= static_cast<std::make_unsigned_t<T>>(
+               static_cast<unsigned char>(in[pos + i]))
+           << (8 * i);
+    }
+    pos += sizeof(T);
+    return static_cast<T>(u);
+  }
+
+  static void CheckAvailable(const string &in, size_t pos, size_t len) {
+    if (pos > in.size() || len > in.size() - pos) {
+      throw std::runtime_error("Truncated snapshot");
+    }
+  }
+
   unordered_map<string, map<int, string>> store_;
 
   size_t ToSizeT(const string &str) {
@@ -327,8 +490,9 @@ int main() {
 
   string blob = timeMap.Serialize();
   // 1) Write to a file
+  string path = (std::filesystem::temp_directory_path() / "data.txt").string();
   {
-    std::ofstream ofs("data.txt"); // open for writing (truncates)
+    std::ofstream ofs(path); // open for writing (truncates)
     if (!ofs) {
       std::cerr << "Open failed\n";
       return 1;
@@ -340,12 +504,13 @@ int main() {
 
   // Read from the file.
   {
-    std::ifstream ifs("data.txt", std::ios::binary);
+    std::ifstream ifs(path, std::ios::binary);
     std::istreambuf_iterator<char> it(ifs);
     std::istreambuf_iterator<char> end;
     std::string blob(it, end);
     timeMap.Deserialize(blob);
   }
+  std::filesystem::remove(path);
 
   cout << "---- Expected: ''\n";
   cout << timeMap.get("CPU", -5) << std::endl;
@@ -362,6 +527,45 @@ int main() {
   cout << "---- Expected: 'jk\tafter tab'\n";
   cout << timeMap.get("Build", 99999) << "\n";
 
+  // Snapshot round trip, decoded in parallel.
+  {
+    TimeMap restored;
+    restored.DeserializeSnapshot(timeMap.SerializeSnapshot(), 4);
+    cout << "---- Expected: ':::::'\n";
+    cout << restored.get("CPU", 107) << std::endl;
+    cout << "---- Expected: 'yz\nnew line'\n";
+    cout << restored.get("Build", 400) << "\n";
+
+    TimeMap big;
+    for (int k = 0; k < 1000; ++k) {
+      for (int ts = 1; ts <= 20; ++ts) {
+        big.set("key" + std::to_string(k), std::to_string(k * ts), ts);
+      }
+    }
+    string snapshot = big.SerializeSnapshot();
+    restored.DeserializeSnapshot(snapshot);
+    cout << "---- Expected: '4995'\n";
+    cout << restored.get("key999", 5) << "\n";
+    try {
+      restored.DeserializeSnapshot(snapshot.substr(0, snapshot.size() / 2));
+    } catch (const std::exception &e) {
+      cout << "---- Expected: 'Truncated snapshot'\n";
+      cout << e.what() << "\n";
+    }
+    // One key "a" with no entries: a later set() would read an empty series.
+    const char empty_series[] = "TMS1"
+                                "\x01\0\0\0\0\0\0\0"  // key_count
+                                "\0\0\0\0\0\0\0\0"    // offsets[0]
+                                "\x01\0\0\0a"          // key
+                                "\0\0\0\0\0\0\0\0";   // entry_count
+    try {
+      restored.DeserializeSnapshot(string(empty_series, sizeof(empty_series) - 1));
+    } catch (const std::exception &e) {
+      cout << "---- Expected: 'Invalid entry count'\n";
+      cout << e.what() << "\n";
+    }
+  }
+
   // randomly generate timestamps
   for (int i = 0; i < 5; ++i) {
     int ts = GenerateRandomTimestamps(1000);
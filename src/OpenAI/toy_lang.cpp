@@ -1,3 +1,17 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
 /*
 Toy language:
 You have a toy language grammar with primitives, tuples, generics, and functions
@@ -27,4 +41,376 @@ P2: Implement infer_return(function, param) -> return
     - Should return [int, char]
     - If params was [int, int, int, int] then raise error for type mismatch (int vs char)
     - If params was [int, int, int, char] then raise error for type conflict
-*/
\ No newline at end of file
+
+Follow-up: Parser
+  - Read signatures from text or files (one per line) in a single pass,
+    straight into compact nodes, reporting the line and column of errors.
+  - Type libraries are multi-megabyte files, so parsing must not allocate
+    per token.
+*/
+
+// Thrown at the first malformed character; line and column are 1-based.
+class ParseError : public std::runtime_error {
+public:
+  ParseError(const string& what, size_t offset, size_t line, size_t column)
+      : std::runtime_error(what + " at " + to_string(line) + ":" +
+                           to_string(column)),
+        offset(offset), line(line), column(column) {}
+
+  size_t offset, line, column;
+};
+
+// 12 bytes per type. A tuple is followed by its elements in preorder, and
+// `extent` skips over a whole subtree, so the elements of a tuple are at
+// i + 1, then each previous element's index + its extent.
+struct TypeNode {
+  enum Kind : uint8_t { kChar, kInt, kFloat, kGeneric, kTuple };
+  Kind kind;
+  uint32_t value;   // kGeneric: generic id; kTuple: number of elements
+  uint32_t extent;  // nodes in this subtree, itself included
+};
+
+// Every signature parsed into it, sharing one node array.
+class TypeLibrary {
+public:
+  struct Signature {
+    uint32_t params;  // node of the first parameter; the rest follow it
+    uint32_t num_params;
+    uint32_t ret;  // root node of the return type
+  };
+
+  const vector<TypeNode>& nodes() const { return nodes_; }
+  const vector<Signature>& signatures() const { return sigs_; }
+  string_view GenericName(uint32_t id) const { return generic_names_[id]; }
+
+  // Formats as written in the grammar: [int, T1] and [int; T1] -> [T1].
+  string ToString(uint32_t node) const {
+    string out;
+    Append(node, out);
+    return out;
+  }
+
+  string ToString(const Signature& sig) const {
+    string out = "[";
+    uint32_t node = sig.params;
+    for (uint32_t i = 0; i < sig.num_params; ++i) {
+      out += i ? "; " : "";
+      Append(node, out);
+      node += nodes_[node].extent;
+    }
+    out += "] -> ";
+    Append(sig.ret, out);
+    return out;
+  }
+
+private:
+  friend class SignatureParser;
+
+  uint32_t InternGeneric(string_view name) {
+    int slot = ShortSlot(name);
+    if (slot >= 0) {
+      if (short_ids_.empty()) {
+        short_ids_.assign(kShortSlots, kNone);
+      }
+      if (short_ids_[slot] == kNone) {
+        short_ids_[slot] = static_cast<uint32_t>(generic_names_.size());
+        generic_names_.emplace_back(name);
+      }
+      return short_ids_[slot];
+    }
+    auto itr = generic_ids_.find(name);
+    if (itr != generic_ids_.end()) {
+      return itr->second;
+    }
+    uint32_t id = static_cast<uint32_t>(generic_names_.size());
+    generic_ids_.emplace(generic_names_.emplace_back(name), id);
+    return id;
+  }
+
+  // Drops every node and generic name added after the library had
+  // `num_nodes` nodes and `num_generics` names, so later ids do not shift.
+  void Truncate(size_t num_nodes, size_t num_generics) {
+    nodes_.resize(num_nodes);
+    while (generic_names_.size() > num_generics) {
+      const string& name = generic_names_.back();
+      int slot = ShortSlot(name);
+      if (slot >= 0) {
+        short_ids_[slot] = kNone;
+      } else {
+        generic_ids_.erase(name);
+      }
+      generic_names_.pop_back();
+    }
+  }
+
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr int kShortSlots = 26 * 111;  // letter x "", 0-9, 00-99
+
+  // Names shaped like the grammar's T1, T2 ... ([A-Z][0-9]{0,2}) index a
+  // direct table instead of being hashed; -1 for any other name.
+  static int ShortSlot(string_view name) {
+    auto digit = [](char c) { return c >= '0' && c <= '9'; };
+    int letter = (name[0] - 'A') * 111;
+    switch (name.size()) {
+      case 1: return letter;
+      case 2: return digit(name[1]) ? letter + 1 + (name[1] - '0') : -1;
+      case 3:
+        return digit(name[1]) && digit(name[2])
+                   ? letter + 11 + (name[1] - '0') * 10 + (name[2] - '0')
+                   : -1;
+      default: return -1;
+    }
+  }
+
+  void Append(uint32_t node, string& out) const {
+    const TypeNode& n = nodes_[node];
+    switch (n.kind) {
+      case TypeNode::kChar: out += "char"; return;
+      case TypeNode::kInt: out += "int"; return;
+      case TypeNode::kFloat: out += "float"; return;
+      case TypeNode::kGeneric: out += generic_names_[n.value]; return;
+      case TypeNode::kTuple: break;
+    }
+    out += '[';
+    uint32_t child = node + 1;
+    for (uint32_t i = 0; i < n.value; ++i) {
+      out += i ? ", " : "";
+      Append(child, out);
+      child += nodes_[child].extent;
+    }
+    out += ']';
+  }
+
+  vector<TypeNode> nodes_;
+  vector<Signature> sigs_;
+  std::deque<string> generic_names_;  // deque: the views below stay valid
+  vector<uint32_t> short_ids_;        // ShortSlot -> id, or kNone
+  unordered_map<string_view, uint32_t> generic_ids_;  // all other names
+};
+
+// Recursive descent over the text, one character of lookahead, writing
+// nodes as it goes. Nothing is allocated per token; only new generic
+// names are copied. A signature that fails to parse leaves the library
+// as it was before that signature.
+//
+// Parameters are separated by ';' as in the grammar, or by ',' as in the
+// P2 examples.
+//
+//   signature := '[' [type ((';' | ',') type)*] ']' '->' type
+//   type      := 'char' | 'int' | 'float' | generic | '[' [type (',' type)*] ']'
+//   generic   := [A-Z][A-Za-z0-9_]*
+class SignatureParser {
+public:
+  explicit SignatureParser(TypeLibrary& lib) : lib_(lib) {}
+
+  // One signature per line; blank lines are skipped.
+  void Parse(string_view text) {
+    text_ = text;
+    pos_ = 0;
+    lib_.nodes_.reserve(lib_.nodes_.size() + text.size() / 4);
+    while (true) {
+      while (pos_ < text_.size() && IsSpace(text_[pos_], true)) {
+        ++pos_;
+      }
+      if (pos_ == text_.size()) {
+        return;
+      }
+      size_t num_nodes = lib_.nodes_.size();
+      size_t num_generics = lib_.generic_names_.size();
+      try {
+        ParseSignature();
+      } catch (const ParseError&) {
+        lib_.Truncate(num_nodes, num_generics);
+        throw;
+      }
+    }
+  }
+
+  void ParseFile(const string& path) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+      throw std::runtime_error("cannot open " + path);
+    }
+    string text(std::filesystem::file_size(path), '\0');  // one read
+    text.resize(std::fread(text.data(), 1, text.size(), f));
+    std::fclose(f);
+    Parse(text);
+  }
+
+private:
+  static constexpr int kMaxDepth = 256;  // bounds the recursion
+
+  static bool IsSpace(char c, bool newline) {
+    return c == ' ' || c == '\t' || c == '\r' || (newline && c == '\n');
+  }
+
+  static bool IsIdent(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+  }
+
+  // Signatures end at a newline, so spaces inside one stop there.
+  char Peek() {
+    while (pos_ < text_.size() && IsSpace(text_[pos_], false)) {
+      ++pos_;
+    }
+    return pos_ < text_.size() ? text_[pos_] : '\0';
+  }
+
+  void Expect(char c) {
+    if (Peek() != c) {
+      Fail(string("expected '") + c + "'", pos_);
+    }
+    ++pos_;
+  }
+
+  [[noreturn]] void Fail(const string& what, size_t at) const {
+    size_t line = 1, line_start = 0;
+    for (size_t i = 0; i < at; ++i) {  // only on errors
+      if (text_[i] == '\n') {
+        ++line;
+        line_start = i + 1;
+      }
+    }
+    string found = at < text_.size() && text_[at] != '\n'
+                       ? string(", found '") + text_[at] + "'"
+                       : string(", found end of line");
+    throw ParseError(what + found, at, line, at - line_start + 1);
+  }
+
+  void ParseSignature() {
+    TypeLibrary::Signature sig;
+    sig.params = static_cast<uint32_t>(lib_.nodes_.size());
+    sig.num_params = 0;
+    Expect('[');
+    if (Peek() != ']') {
+      do {
+        ParseType(0);
+        ++sig.num_params;
+      } while ((Peek() == ';' || Peek() == ',') && ++pos_);
+    }
+    Expect(']');
+    Expect('-');
+    Expect('>');
+    sig.ret = static_cast<uint32_t>(lib_.nodes_.size());
+    ParseType(0);
+    if (Peek() != '\0' && text_[pos_] != '\n') {
+      Fail("expected end of line", pos_);
+    }
+    lib_.sigs_.push_back(sig);
+  }
+
+  void ParseType(int depth) {
+    char c = Peek();
+    size_t start = pos_;
+    if (c == '[') {
+      if (depth == kMaxDepth) {
+        Fail("tuples nested too deeply", start);
+      }
+      ++pos_;
+      size_t self = lib_.nodes_.size();
+      lib_.nodes_.push_back({TypeNode::kTuple, 0, 0});
+      uint32_t count = 0;
+      if (Peek() != ']') {
+        do {
+          ParseType(depth + 1);
+          ++count;
+        } while (Peek() == ',' && ++pos_);
+      }
+      Expect(']');
+      lib_.nodes_[self].value = count;
+      lib_.nodes_[self].extent = static_cast<uint32_t>(lib_.nodes_.size() - self);
+      return;
+    }
+    if (!IsIdent(c) || (c >= '0' && c <= '9') || c == '_') {
+      Fail("expected a type", start);
+    }
+    while (pos_ < text_.size() && IsIdent(text_[pos_])) {
+      ++pos_;
+    }
+    string_view word = text_.substr(start, pos_ - start);
+    if (c >= 'A' && c <= 'Z') {
+      lib_.nodes_.push_back({TypeNode::kGeneric, lib_.InternGeneric(word), 1});
+    } else if (word == "int") {
+      lib_.nodes_.push_back({TypeNode::kInt, 0, 1});
+    } else if (word == "char") {
+      lib_.nodes_.push_back({TypeNode::kChar, 0, 1});
+    } else if (word == "float") {
+      lib_.nodes_.push_back({TypeNode::kFloat, 0, 1});
+    } else {
+      Fail("unknown primitive '" + string(word) + "'", start);
+    }
+  }
+
+  TypeLibrary& lib_;
+  string_view text_;
+  size_t pos_ = 0;
+};
+
+int main() {
+  TypeLibrary lib;
+  SignatureParser parser(lib);
+  parser.Parse("[int; [int, T1]; T2] -> [char, T2, [float, float]]\n"
+               "\n"
+               "  [T1,T2 ,int,T1]->[T1,T2]\n"
+               "[] -> [[], int]");
+  cout << lib.signatures().size() << " [EXPECTED: 3]\n";
+  cout << lib.ToString(lib.signatures()[0])
+       << " [EXPECTED: [int; [int, T1]; T2] -> [char, T2, [float, float]]]\n";
+  cout << lib.ToString(lib.signatures()[1]) << " [EXPECTED: [T1; T2; int; T1] -> [T1, T2]]\n";
+  cout << lib.ToString(lib.signatures()[2]) << " [EXPECTED: [] -> [[], int]]\n";
+  cout << lib.nodes().size() << " [EXPECTED: 21]\n";
+  cout << lib.ToString(lib.signatures()[0].params + 1) << " [EXPECTED: [int, T1]]\n";
+  cout << lib.GenericName(1) << " [EXPECTED: T2]\n";
+
+  cout << "\n=== Errors ===\n";
+  vector<pair<string_view, string_view>> bad = {
+      {"[int; [int, T1]; T2] -> [char, T2, [float, float]",
+       "expected ']', found end of line at 1:50"},
+      {"[int; bool] -> [int]", "unknown primitive 'bool', found 'b' at 1:7"},
+      {"[int] -> [int]\n[int] -> [int]\n[int] => [int]",
+       "expected '-', found '=' at 3:7"},
+      {"[int; [int,]] -> [int]", "expected a type, found ']' at 1:12"},
+      {"[int] -> [int] [int]", "expected end of line, found '[' at 1:16"},
+      {"[Key; Q9] -> Key]", "expected end of line, found ']' at 1:17"}};
+  for (const auto& [text, expected] : bad) {
+    try {
+      parser.Parse(text);
+      cout << "parsed";
+    } catch (const ParseError& e) {
+      cout << e.what();
+    }
+    cout << " [EXPECTED: " << expected << "]\n";
+  }
+  // Good lines before an error are kept; the bad signature is rolled back.
+  cout << lib.signatures().size() << " [EXPECTED: 5]\n";
+  cout << lib.nodes().size() << " [EXPECTED: 27]\n";
+  // ...and so are the generic names it introduced.
+  parser.Parse("[Z1] -> Other");
+  cout << lib.GenericName(2) << ", " << lib.GenericName(3) << " [EXPECTED: Z1, Other]\n";
+
+  cout << "\n=== File input ===\n";
+  string text;
+  for (int i = 0; text.size() < (8 << 20); ++i) {
+    text += "[int; [int, T" + to_string(i % 10) + "]; T2; [char, [float, U" +
+            to_string(i % 7) + "]]] -> [char, T2, [float, float], U" +
+            to_string(i % 7) + "]\n";
+  }
+  string path = (std::filesystem::temp_directory_path() / "toy_lang.sig").string();
+  FILE* f = std::fopen(path.c_str(), "wb");
+  std::fwrite(text.data(), 1, text.size(), f);
+  std::fclose(f);
+  TypeLibrary big;
+  SignatureParser file_parser(big);
+  auto start = std::chrono::steady_clock::now();
+  file_parser.ParseFile(path);
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::filesystem::remove(path);
+  cout << big.ToString(big.signatures()[3])
+       << " [EXPECTED: [int; [int, T3]; T2; [char, [float, U3]]] -> [char, T2, [float, float], U3]]\n";
+  cout << big.nodes().size() / big.signatures().size() << " [EXPECTED: 17]\n";
+  cout << "parsed " << text.size() / 1e6 << " MB, " << big.signatures().size()
+       << " signatures at " << text.size() / 1e6 / secs << " MB/s\n";
+
+  return 0;
+}
@@ -1,8 +1,27 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <variant>
 #include <unordered_map>
+#include <unordered_set>
 #include <stdexcept>
 #include <sstream>
 
@@ -48,6 +67,33 @@ using namespace std;
 // Notes:
 // - Node can be deeply nested
 // - The type system supports structural typing with generic substitution
+//
+// Follow-up 1: Hash-consed types
+// - TypeArena interns every structurally distinct type once, with its hash
+//   and id computed up front. Equality is a pointer comparison and
+//   substitution shares every subtree it does not change.
+//
+// Follow-up 2: Unification
+// - Generics may appear in the arguments too, and may be bound to each
+//   other. A union-find Unifier keeps equivalence classes of type
+//   variables with an occurs-check, and applies the substitution only when
+//   a result is read.
+//
+// Follow-up 3: Instantiation cache
+// - The same generic function is applied to the same argument types over
+//   and over. Cache the return type per (function, interned argument
+//   types) so a repeat call is one hash lookup, safe across threads.
+//
+// Follow-up 4: Batch checking
+// - Check a whole module's call sites on all cores. Workers read one frozen
+//   shared arena without locks and intern new result types into their own
+//   scratch arena.
+//
+// Follow-up 5: Binary encoding
+// - Node::ToString cannot be read back. Encode type trees as preorder tags
+//   with child counts and interned name ids, and read them in place from an
+//   mmap'd file so a precompiled library loads instantly and is shared
+//   between processes through the page cache.
 class Node {
 public:
   // Node() = default;
@@ -199,6 +245,991 @@ Node GetReturnType(Function& func, vector<Node>& args) {
   return ReplaceGeneric(func.ret_, generic_map);
 }
 
+// Follow-up 1: hash-consed types.
+bool IsPrimitive(std::string_view name) {
+  return name == "int" || name == "str" || name == "bool" ||
+         name == "double" || name == "float" || name == "void";
+}
+
+class TypeArena {
+public:
+  // Immutable and owned by the arena; two Type pointers are equal exactly
+  // when the types are structurally equal.
+  struct Type {
+    uint32_t id;
+    uint64_t hash;
+    string name;                // primitive or generic; empty for tuples
+    vector<const Type*> elems;  // tuple elements
+    bool is_tuple;
+    bool is_generic;   // a type variable such as T
+    bool has_generic;  // a type variable occurs somewhere inside
+  };
+
+  TypeArena() = default;
+
+  // A scratch arena layered over `base`: types already in `base` are
+  // returned from there, and only new ones are interned here. `base` is
+  // read without locks, so it must not change while this arena lives.
+  explicit TypeArena(const TypeArena* base)
+      : base_(base), id_offset_(base->id_offset_ + base->size()) {}
+
+  const Type* Base(const string& name) {
+    if (const Type* found = FindBase(name)) {
+      return found;
+    }
+    Type& t = NewType();
+    t.hash = Mix(std::hash<string>()(name));
+    t.name = name;
+    t.is_tuple = false;
+    t.is_generic = !IsPrimitive(name);
+    t.has_generic = t.is_generic;
+    bases_.emplace(name, &t);
+    return &t;
+  }
+
+  const Type* Tuple(const vector<const Type*>& elems) {
+    uint64_t h = Mix(kTupleSeed + elems.size());
+    for (const Type* e : elems) {
+      h = Mix(h ^ e->hash);
+    }
+    if (const Type* found = FindTuple(elems, h)) {
+      return found;
+    }
+    Type& t = NewType();
+    t.hash = h;
+    t.elems = elems;
+    t.is_tuple = true;
+    t.is_generic = false;
+    t.has_generic = false;
+    for (const Type* e : elems) {
+      t.has_generic = t.has_generic || e->has_generic;
+    }
+    tuples_.emplace(h, &t);
+    return &t;
+  }
+
+  const Type* FromNode(const Node& node) {
+    if (std::holds_alternative<string>(node.value_)) {
+      return Base(std::get<string>(node.value_));
+    }
+    vector<const Type*> elems;
+    for (const Node& n : std::get<vector<Node>>(node.value_)) {
+      elems.push_back(FromNode(n));
+    }
+    return Tuple(elems);
+  }
+
+  // Same format as Node::ToString.
+  string ToString(const Type* t) const {
+    if (!t->is_tuple) {
+      return t->name;
+    }
+    string out = "(";
+    for (size_t i = 0; i < t->elems.size(); ++i) {
+      out += (i ? "," : "") + ToString(t->elems[i]);
+    }
+    return out + ")";
+  }
+
+  // Replaces the generics bound in `subst`. Subtrees without a bound
+  // generic come back as the same pointer, so nothing is allocated for them.
+  const Type* Substitute(const Type* t,
+                         const unordered_map<const Type*, const Type*>& subst) {
+    if (!t->has_generic) {
+      return t;
+    }
+    if (t->is_generic) {
+      auto itr = subst.find(t);
+      return itr == subst.end() ? t : itr->second;
+    }
+    vector<const Type*> elems;
+    bool changed = false;
+    for (size_t i = 0; i < t->elems.size(); ++i) {
+      const Type* e = Substitute(t->elems[i], subst);
+      if (!changed && e != t->elems[i]) {
+        changed = true;
+        elems.assign(t->elems.begin(), t->elems.begin() + i);
+      }
+      if (changed) {
+        elems.push_back(e);
+      }
+    }
+    return changed ? Tuple(elems) : t;
+  }
+
+  size_t size() const { return types_.size(); }  // excluding the base
+
+  static uint64_t Mix(uint64_t x) {  // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+private:
+  static constexpr uint64_t kTupleSeed = 0x7475706c65ull;
+
+  const Type* FindBase(const string& name) const {
+    if (base_) {
+      if (const Type* found = base_->FindBase(name)) {
+        return found;
+      }
+    }
+    auto itr = bases_.find(name);
+    return itr == bases_.end() ? nullptr : itr->second;
+  }
+
+  const Type* FindTuple(const vector<const Type*>& elems, uint64_t h) const {
+    if (base_) {
+      if (const Type* found = base_->FindTuple(elems, h)) {
+        return found;
+      }
+    }
+    auto range = tuples_.equal_range(h);
+    for (auto itr = range.first; itr != range.second; ++itr) {
+      if (itr->second->elems == elems) {  // children are interned already
+        return itr->second;
+      }
+    }
+    return nullptr;
+  }
+
+  Type& NewType() {
+    Type& t = types_.emplace_back();
+    t.id = static_cast<uint32_t>(id_offset_ + types_.size() - 1);
+    return t;
+  }
+
+  const TypeArena* base_ = nullptr;
+  size_t id_offset_ = 0;  // ids continue after the base's, so they stay unique
+
+  std::deque<Type> types_;  // deque: pointers stay valid as it grows
+  unordered_map<string, const Type*> bases_;
+  unordered_multimap<uint64_t, const Type*> tuples_;  // hash -> tuples
+};
+
+using Type = TypeArena::Type;
+
+// A Function whose types live in a TypeArena.
+struct Signature {
+  vector<const Type*> args;
+  const Type* ret;
+};
+
+// IsMatch over interned types; a subtree without generics matches by
+// pointer comparison alone.
+bool IsMatch(const Type* nf, const Type* na,
+             unordered_map<const Type*, const Type*>& bindings) {
+  if (nf->is_generic) {
+    auto [itr, inserted] = bindings.try_emplace(nf, na);
+    return inserted || itr->second == na;
+  }
+  if (!nf->has_generic) {
+    return nf == na;
+  }
+  if (!na->is_tuple || nf->elems.size() != na->elems.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < nf->elems.size(); ++i) {
+    if (!IsMatch(nf->elems[i], na->elems[i], bindings)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// nullptr when the arguments do not match.
+const Type* GetReturnType(TypeArena& arena, const Signature& func,
+                          const vector<const Type*>& args) {
+  if (func.args.size() != args.size()) {
+    return nullptr;
+  }
+  unordered_map<const Type*, const Type*> bindings;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (!IsMatch(func.args[i], args[i], bindings)) {
+      return nullptr;
+    }
+  }
+  return arena.Substitute(func.ret, bindings);
+}
+
+// Follow-up 2: union-find unification. The function's generics and the
+// caller's generics are different variables even when they share a name,
+// so every variable is keyed by (side, type). Each equivalence class has a
+// root, and the root may be bound to one non-variable term. Bindings are
+// recorded, not applied: Apply builds a resolved type only on request.
+class Unifier {
+public:
+  enum Side { kFunc = 0, kArgs = 1 };
+
+  explicit Unifier(TypeArena& arena) : arena_(arena) {}
+
+  void Reset() {
+    var_index_.clear();
+    parent_.clear();
+    rank_.clear();
+    bound_.clear();
+    taken_.clear();
+    fresh_.clear();
+  }
+
+  // Unifies `a` (on side sa) with `b` (on side sb); false on a mismatch or
+  // when a variable would contain itself. A failed call may leave partial
+  // bindings behind; Reset before reusing the unifier.
+  bool Unify(const Type* a, Side sa, const Type* b, Side sb) {
+    NoteNames({a, sa});
+    NoteNames({b, sb});
+    return UnifyTerms(a, sa, b, sb);
+  }
+
+  // `t` with every bound variable replaced. Subtrees that resolve to
+  // themselves are shared. An unbound class reads as a caller's variable
+  // when it has one; a class of function variables only keeps its name
+  // unless the caller uses it too, and is renamed T1, T2, ... then, so a
+  // function's T never reads as the caller's unrelated T.
+  const Type* Apply(const Type* t, Side side) {
+    if (!t->has_generic) {
+      return t;
+    }
+    Term term = Walk({t, side});
+    if (term.type->is_generic) {
+      return term.side == kArgs ? term.type : FreeName(term);
+    }
+    if (term.type != t || term.side != side) {
+      return Apply(term.type, term.side);
+    }
+    vector<const Type*> elems;
+    bool changed = false;
+    for (size_t i = 0; i < t->elems.size(); ++i) {
+      const Type* e = Apply(t->elems[i], side);
+      if (!changed && e != t->elems[i]) {
+        changed = true;
+        elems.assign(t->elems.begin(), t->elems.begin() + i);
+      }
+      if (changed) {
+        elems.push_back(e);
+      }
+    }
+    return changed ? arena_.Tuple(elems) : t;
+  }
+
+private:
+  struct Term {
+    const Type* type;
+    Side side;
+  };
+
+  bool UnifyTerms(const Type* a, Side sa, const Type* b, Side sb) {
+    Term x = Walk({a, sa});
+    Term y = Walk({b, sb});
+    if (x.type == y.type && (x.side == y.side || !x.type->has_generic)) {
+      return true;
+    }
+    if (x.type->is_generic && y.type->is_generic) {
+      Union(Var(x), Var(y));
+      return true;
+    }
+    if (x.type->is_generic) {
+      return Bind(Var(x), y);
+    }
+    if (y.type->is_generic) {
+      return Bind(Var(y), x);
+    }
+    if (!x.type->is_tuple || !y.type->is_tuple ||
+        x.type->elems.size() != y.type->elems.size()) {
+      return false;  // different primitives, or tuple vs primitive
+    }
+    for (size_t i = 0; i < x.type->elems.size(); ++i) {
+      if (!UnifyTerms(x.type->elems[i], x.side, y.type->elems[i], y.side)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Records the caller's generic names in taken_.
+  void NoteNames(Term t) {
+    if (t.side != kArgs || !t.type->has_generic) {
+      return;
+    }
+    if (t.type->is_generic) {
+      taken_.insert(t.type);
+      return;
+    }
+    for (const Type* e : t.type->elems) {
+      NoteNames({e, t.side});
+    }
+  }
+
+  // Name of the unbound class of function variables `t`, picked once.
+  const Type* FreeName(Term t) {
+    auto [itr, inserted] = fresh_.try_emplace(Find(Var(t)), nullptr);
+    if (inserted) {
+      const Type* name = t.type;
+      for (int i = 1; taken_.count(name); ++i) {
+        name = arena_.Base("T" + std::to_string(i));
+      }
+      taken_.insert(name);
+      itr->second = name;
+    }
+    return itr->second;
+  }
+
+  // Index of the variable (side, t), created on first use.
+  int Var(Term t) {
+    uint64_t key = uint64_t{t.type->id} << 1 | t.side;
+    auto [itr, inserted] =
+        var_index_.try_emplace(key, static_cast<int>(parent_.size()));
+    if (inserted) {
+      parent_.push_back(itr->second);
+      rank_.push_back(0);
+      bound_.push_back({t.type, t.side});  // unbound: the variable itself
+    }
+    return itr->second;
+  }
+
+  int Find(int v) {
+    int root = v;
+    while (parent_[root] != root) {
+      root = parent_[root];
+    }
+    while (parent_[v] != root) {  // path compression
+      int next = parent_[v];
+      parent_[v] = root;
+      v = next;
+    }
+    return root;
+  }
+
+  bool IsBound(int root) const { return !bound_[root].type->is_generic; }
+
+  // Follows a variable to its class's binding, or to the variable that
+  // represents it: a caller's one if the class has any.
+  Term Walk(Term t) {
+    if (!t.type->is_generic) {
+      return t;
+    }
+    return bound_[Find(Var(t))];
+  }
+
+  void Union(int a, int b) {
+    a = Find(a);
+    b = Find(b);
+    if (a == b) {
+      return;
+    }
+    if (rank_[a] < rank_[b]) {
+      std::swap(a, b);
+    }
+    parent_[b] = a;  // both unbound: Walk never returns a bound variable
+    rank_[a] += rank_[a] == rank_[b];
+    if (bound_[a].side == kFunc && bound_[b].side == kArgs) {
+      bound_[a] = bound_[b];  // the caller's name stands for the class
+    }
+  }
+
+  bool Bind(int v, Term t) {
+    int root = Find(v);
+    if (Occurs(root, t)) {
+      return false;
+    }
+    bound_[root] = t;
+    return true;
+  }
+
+  // Occurs-check: does the class `root` appear inside `t`?
+  bool Occurs(int root, Term t) {
+    if (!t.type->has_generic) {
+      return false;
+    }
+    t = Walk(t);
+    if (t.type->is_generic) {
+      return Find(Var(t)) == root;
+    }
+    for (const Type* e : t.type->elems) {
+      if (Occurs(root, {e, t.side})) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  TypeArena& arena_;
+  unordered_map<uint64_t, int> var_index_;  // (type id, side) -> variable
+  vector<int> parent_, rank_;
+  vector<Term> bound_;  // per root: its binding, or its representative
+  unordered_set<const Type*> taken_;          // generic names the caller uses
+  unordered_map<int, const Type*> fresh_;     // root -> name of a free class
+};
+
+// GetReturnType through the Unifier; nullptr when the arguments do not
+// unify with the parameters.
+const Type* InferReturnType(Unifier& unifier, const Signature& func,
+                            const vector<const Type*>& args) {
+  unifier.Reset();
+  if (func.args.size() != args.size()) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (!unifier.Unify(func.args[i], Unifier::kFunc, args[i], Unifier::kArgs)) {
+      return nullptr;
+    }
+  }
+  return unifier.Apply(func.ret, Unifier::kFunc);
+}
+
+// Follow-up 3: memoized InferReturnType. A function is identified by its
+// Signature's address, so signatures must outlive the cache. Argument
+// types are interned, so a key compares by pointers and a hit touches
+// neither the arena nor the unifier. Failed instantiations (nullptr) are
+// cached too.
+//
+// Lookups take a shared lock on one of kShards shards; only a miss takes
+// the shard exclusively, plus arena_mu_ around the arena. While the cache
+// is in use from several threads, nobody else may write to the arena.
+class InstantiationCache {
+public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t entries = 0;
+  };
+
+  explicit InstantiationCache(TypeArena& arena) : arena_(arena), unifier_(arena) {}
+
+  const Type* Get(const Signature& func, const vector<const Type*>& args) {
+    uint64_t h = Key(func, args);
+    Shard& shard = shards_[h % kShards];
+    {
+      std::shared_lock lock(shard.mu);
+      if (const Entry* e = Find(shard, h, func, args)) {
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return e->ret;
+      }
+    }
+    const Type* ret;
+    {
+      std::lock_guard lock(arena_mu_);
+      ret = InferReturnType(unifier_, func, args);
+    }
+    std::unique_lock lock(shard.mu);
+    if (const Entry* e = Find(shard, h, func, args)) {  // lost a race
+      shard.hits.fetch_add(1, std::memory_order_relaxed);
+      return e->ret;
+    }
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
+    shard.entries.emplace(h, Entry{&func, args, ret});
+    return ret;
+  }
+
+  Stats stats() const {
+    Stats s;
+    for (const Shard& shard : shards_) {
+      s.hits += shard.hits.load(std::memory_order_relaxed);
+      s.misses += shard.misses.load(std::memory_order_relaxed);
+      std::shared_lock lock(shard.mu);
+      s.entries += shard.entries.size();
+    }
+    return s;
+  }
+
+  void Clear() {
+    for (Shard& shard : shards_) {
+      std::unique_lock lock(shard.mu);
+      shard.entries.clear();
+      shard.hits = 0;
+      shard.misses = 0;
+    }
+  }
+
+private:
+  static constexpr size_t kShards = 16;
+
+  struct Entry {
+    const Signature* func;
+    vector<const Type*> args;
+    const Type* ret;
+  };
+
+  // alignas: shards' counters are bumped by different threads.
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mu;
+    unordered_multimap<uint64_t, Entry> entries;  // key hash -> entries
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+  };
+
+  static uint64_t Key(const Signature& func, const vector<const Type*>& args) {
+    uint64_t h = TypeArena::Mix(reinterpret_cast<uintptr_t>(&func));
+    for (const Type* a : args) {
+      h = TypeArena::Mix(h ^ a->hash);
+    }
+    return h;
+  }
+
+  static const Entry* Find(const Shard& shard, uint64_t h, const Signature& func,
+                           const vector<const Type*>& args) {
+    auto range = shard.entries.equal_range(h);
+    for (auto itr = range.first; itr != range.second; ++itr) {
+      if (itr->second.func == &func && itr->second.args == args) {
+        return &itr->second;
+      }
+    }
+    return nullptr;
+  }
+
+  TypeArena& arena_;
+  std::mutex arena_mu_;  // guards arena_ and unifier_
+  Unifier unifier_;
+  std::array<Shard, kShards> shards_;
+};
+
+// Follow-up 4: a call site for CheckBatch.
+struct Call {
+  const Signature* func;
+  vector<const Type*> args;
+};
+
+// Results of CheckBatch, one per call in call order. Result types live in
+// `shared` or in one of the scratch arenas, which the batch owns. Types
+// from different scratch arenas are not interned together: compare those
+// with ToString, not by pointer.
+struct CheckBatchResult {
+  enum class Error { kNone, kArity, kMismatch };
+  struct Result {
+    const Type* ret;  // nullptr on error
+    Error error;
+    size_t arg;  // kMismatch: index of the first argument that failed
+  };
+  vector<Result> results;
+  vector<std::unique_ptr<TypeArena>> scratch;  // one per worker
+};
+
+// Threads kept across batches, so a batch pays no thread start-up. Run(n,
+// fn) calls fn(0) on the caller and fn(1) .. fn(n - 1) on pool threads, and
+// returns once every call has finished. One Run at a time; fn must not
+// throw.
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t num_threads) {
+    for (size_t i = 1; i < num_threads; ++i) {
+      threads_.emplace_back([this] { Loop(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+      t.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Workers a Run can use, the caller included.
+  size_t size() const { return threads_.size() + 1; }
+
+  void Run(size_t n, const std::function<void(size_t)>& fn) {
+    std::lock_guard<std::mutex> run(run_mtx_);
+    n = std::max<size_t>(std::min(n, size()), 1);
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      job_ = &fn;
+      jobs_ = n;
+      next_ = 1;
+      busy_ = n - 1;
+      ++generation_;
+    }
+    cv_.notify_all();
+    fn(0);
+    std::unique_lock<std::mutex> lock(mtx_);
+    done_cv_.wait(lock, [this] { return busy_ == 0; });
+    job_ = nullptr;
+  }
+
+private:
+  void Loop() {
+    uint64_t seen = 0;
+    while (true) {
+      size_t w;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+        if (next_ == jobs_) {
+          continue;  // every call of this Run is taken
+        }
+        w = next_++;
+      }
+      (*job_)(w);
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (--busy_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  vector<std::thread> threads_;
+  std::mutex run_mtx_;  // serializes Run
+  std::mutex mtx_;
+  std::condition_variable cv_, done_cv_;
+  const std::function<void(size_t)>* job_ = nullptr;
+  size_t jobs_ = 0, next_ = 0, busy_ = 0;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+};
+
+// Type-checks every call on the threads of `pool`. `shared` holds every
+// type the calls mention and is only read, without locks, so it must not
+// change until the batch returns. Each worker interns new result types into its
+// own scratch arena layered over `shared`, and has its own Unifier.
+CheckBatchResult CheckBatch(const TypeArena& shared, const vector<Call>& calls,
+                            WorkerPool& pool) {
+  using Error = CheckBatchResult::Error;
+  constexpr size_t kGrain = 256;
+  size_t num_threads = std::min(pool.size(), (calls.size() + kGrain - 1) / kGrain);
+  num_threads = std::max<size_t>(num_threads, 1);
+
+  CheckBatchResult batch;
+  batch.results.resize(calls.size());
+  for (size_t w = 0; w < num_threads; ++w) {
+    batch.scratch.push_back(std::make_unique<TypeArena>(&shared));
+  }
+  // Workers claim chunks from a shared counter and write disjoint results.
+  std::atomic<size_t> next{0};
+  pool.Run(num_threads, [&](size_t w) {
+    Unifier unifier(*batch.scratch[w]);
+    size_t begin;
+    while ((begin = next.fetch_add(kGrain)) < calls.size()) {
+      for (size_t i = begin; i < std::min(begin + kGrain, calls.size()); ++i) {
+        const Call& call = calls[i];
+        CheckBatchResult::Result& r = batch.results[i];
+        r = {nullptr, Error::kNone, 0};
+        if (call.func->args.size() != call.args.size()) {
+          r.error = Error::kArity;
+          continue;
+        }
+        unifier.Reset();
+        for (; r.arg < call.args.size(); ++r.arg) {
+          if (!unifier.Unify(call.func->args[r.arg], Unifier::kFunc,
+                             call.args[r.arg], Unifier::kArgs)) {
+            r.error = Error::kMismatch;
+            break;
+          }
+        }
+        if (r.error == Error::kNone) {
+          r.ret = unifier.Apply(call.func->ret, Unifier::kFunc);
+          r.arg = 0;
+        }
+      }
+    }
+  });
+  return batch;
+}
+
+// Follow-up 5: binary type libraries.
+//
+// Layout (all integers little-endian u32, the sections 4-byte aligned):
+//   header        magic "TYP1", num_names, num_types, names_bytes, stream_bytes
+//   name_offsets  num_names + 1 offsets into names; name i is [off[i], off[i+1])
+//   type_offsets  num_types offsets into stream, one per encoded root
+//   names         the name bytes, padded to 4
+//   stream        every type in preorder, one tag per node
+//
+// A tag byte is kind | value << 2, where value is the name id of a
+// primitive or generic, or the element count of a tuple. A value of 63 or
+// more stores 63 in the tag and the real value as a LEB128 varint after
+// it, so common nodes take one byte.
+namespace encoded {
+
+enum Kind : uint8_t { kPrimitive = 0, kGeneric = 1, kTuple = 2 };
+constexpr char kMagic[4] = {'T', 'Y', 'P', '1'};
+constexpr uint32_t kInlineMax = 63;
+constexpr size_t kHeaderWords = 5;
+
+}  // namespace encoded
+
+// Builds a binary type library from interned types.
+class TypeEncoder {
+public:
+  // Appends a root; its index in the library is the return value.
+  uint32_t Add(const Type* t) {
+    roots_.push_back(static_cast<uint32_t>(stream_.size()));
+    Encode(t);
+    return static_cast<uint32_t>(roots_.size() - 1);
+  }
+
+  string Finish() const {
+    vector<uint32_t> words = {0, static_cast<uint32_t>(names_.size()),
+                              static_cast<uint32_t>(roots_.size()), 0,
+                              static_cast<uint32_t>(stream_.size())};
+    std::memcpy(&words[0], encoded::kMagic, 4);
+    uint32_t offset = 0;
+    for (const Type* name : names_) {
+      words.push_back(offset);
+      offset += static_cast<uint32_t>(name->name.size());
+    }
+    words.push_back(offset);
+    words[3] = (offset + 3) & ~3u;
+    words.insert(words.end(), roots_.begin(), roots_.end());
+
+    string out(words.size() * 4, '\0');
+    std::memcpy(out.data(), words.data(), out.size());  // assumes little-endian
+    for (const Type* name : names_) {
+      out += name->name;
+    }
+    out.resize(out.size() + words[3] - offset);
+    return out + stream_;
+  }
+
+  void WriteFile(const string& path) const {
+    string bytes = Finish();
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f || std::fwrite(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+      if (f) {
+        std::fclose(f);
+      }
+      throw std::runtime_error("cannot write " + path);
+    }
+    std::fclose(f);
+  }
+
+private:
+  void Encode(const Type* t) {
+    if (t->is_tuple) {
+      Tag(encoded::kTuple, static_cast<uint32_t>(t->elems.size()));
+      for (const Type* e : t->elems) {
+        Encode(e);
+      }
+      return;
+    }
+    // Base types are interned, so the pointer identifies the name.
+    auto [itr, inserted] =
+        name_ids_.try_emplace(t, static_cast<uint32_t>(names_.size()));
+    if (inserted) {
+      names_.push_back(t);
+    }
+    Tag(t->is_generic ? encoded::kGeneric : encoded::kPrimitive, itr->second);
+  }
+
+  void Tag(encoded::Kind kind, uint32_t value) {
+    uint32_t inline_value = std::min(value, encoded::kInlineMax);
+    stream_ += static_cast<char>(kind | inline_value << 2);
+    if (inline_value == encoded::kInlineMax) {
+      for (; value >= 0x80; value >>= 7) {
+        stream_ += static_cast<char>(value | 0x80);
+      }
+      stream_ += static_cast<char>(value);
+    }
+  }
+
+  vector<const Type*> names_;  // name id -> base type
+  unordered_map<const Type*, uint32_t> name_ids_;
+  vector<uint32_t> roots_;     // offsets into stream_
+  string stream_;
+};
+
+// A read-only view of an encoded library. Nothing is copied: types are
+// decoded from the bytes as they are walked, and every read is bounds
+// checked, so a truncated or corrupt file throws instead of reading past
+// the end. The bytes must outlive the view.
+class EncodedTypes {
+public:
+  static constexpr int kMaxDepth = 256;  // bounds the recursion
+
+  // One encoded node; cheap to copy.
+  class Ref {
+  public:
+    encoded::Kind kind() const { return kind_; }
+    bool is_tuple() const { return kind_ == encoded::kTuple; }
+    size_t size() const { return is_tuple() ? value_ : 0; }  // elements
+    string_view name() const { return lib_->Name(value_); }  // non-tuples
+
+    // The first element of a non-empty tuple; the rest follow through
+    // Next(). The last node in the file has no Next().
+    Ref Child() const { return lib_->Decode(end_); }
+
+    // The node after this subtree, i.e. this node's next sibling.
+    Ref Next() const {
+      Ref r = *this;
+      for (size_t pending = 1; pending > 0; --pending) {  // skip the subtree
+        pending += r.size();
+        r = lib_->Decode(r.end_);
+      }
+      return r;
+    }
+
+    // Same format as TypeArena::ToString.
+    string ToString() const {
+      string out;
+      Append(out, 0);
+      return out;
+    }
+
+  private:
+    friend class EncodedTypes;
+
+    void Append(string& out, int depth) const {
+      if (!is_tuple()) {
+        out += name();
+        return;
+      }
+      Check(depth < kMaxDepth);
+      out += '(';
+      Ref e = *this;
+      for (size_t i = 0; i < size(); ++i) {
+        e = i ? e.Next() : Child();
+        out += i ? "," : "";
+        e.Append(out, depth + 1);
+      }
+      out += ')';
+    }
+
+    const EncodedTypes* lib_;
+    const uint8_t* end_;  // first byte after this node's tag
+    encoded::Kind kind_;
+    uint32_t value_;
+  };
+
+  EncodedTypes(const void* data, size_t size)
+      : data_(static_cast<const uint8_t*>(data)), size_(size) {
+    uint32_t header[encoded::kHeaderWords];
+    Check(size_ >= sizeof(header));
+    std::memcpy(header, data_, sizeof(header));
+    Check(std::memcmp(header, encoded::kMagic, 4) == 0);
+    num_names_ = header[1];
+    num_types_ = header[2];
+    uint64_t tables = sizeof(header) + (uint64_t{num_names_} + 1 + num_types_) * 4;
+    Check(tables + header[3] + header[4] == size_);
+    words_ = data_ + sizeof(header);
+    names_ = reinterpret_cast<const char*>(data_ + tables);
+    names_bytes_ = header[3];
+    stream_ = data_ + tables + header[3];
+    stream_end_ = stream_ + header[4];
+  }
+
+  size_t size() const { return num_types_; }
+
+  Ref operator[](size_t i) const {
+    Check(i < num_types_);
+    uint32_t offset = Word(num_names_ + 1 + i);
+    Check(offset < stream_end_ - stream_);
+    return Decode(stream_ + offset);
+  }
+
+  string_view Name(uint32_t id) const {
+    Check(id < num_names_);
+    uint32_t begin = Word(id), end = Word(id + 1);
+    Check(begin <= end && end <= names_bytes_);
+    return string_view(names_ + begin, end - begin);
+  }
+
+  // Interns an encoded type, so it compares by pointer with everything
+  // else in `arena`.
+  const Type* Load(TypeArena& arena, Ref r) const { return Load(arena, r, 0); }
+
+private:
+  const Type* Load(TypeArena& arena, Ref r, int depth) const {
+    if (!r.is_tuple()) {
+      return arena.Base(string(r.name()));
+    }
+    Check(depth < kMaxDepth);
+    vector<const Type*> elems;
+    elems.reserve(r.size());
+    Ref e = r;
+    for (size_t i = 0; i < r.size(); ++i) {
+      e = i ? e.Next() : r.Child();
+      elems.push_back(Load(arena, e, depth + 1));
+    }
+    return arena.Tuple(elems);
+  }
+
+  static void Check(bool ok) {
+    if (!ok) {
+      throw std::runtime_error("corrupt type library");
+    }
+  }
+
+  uint32_t Word(size_t i) const {  // sections are 4-byte aligned
+    uint32_t w;
+    std::memcpy(&w, words_ + i * 4, 4);
+    return w;
+  }
+
+  Ref Decode(const uint8_t* p) const {
+    Check(p < stream_end_);
+    Ref r;
+    r.lib_ = this;
+    r.kind_ = static_cast<encoded::Kind>(*p & 3);
+    r.value_ = *p++ >> 2;
+    Check(r.kind_ <= encoded::kTuple);
+    if (r.value_ == encoded::kInlineMax) {
+      r.value_ = 0;
+      for (int shift = 0;; shift += 7) {
+        Check(p < stream_end_ && shift < 32);
+        r.value_ |= uint32_t{*p & 0x7fu} << shift;
+        if (!(*p++ & 0x80)) {
+          break;
+        }
+      }
+    }
+    // Every element takes at least one byte.
+    Check(r.kind_ != encoded::kTuple || r.value_ <= size_t(stream_end_ - p));
+    r.end_ = p;
+    return r;
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+  uint32_t num_names_, num_types_, names_bytes_;
+  const uint8_t* words_;  // name_offsets then type_offsets
+  const char* names_;
+  const uint8_t* stream_;
+  const uint8_t* stream_end_;
+};
+
+// A whole file mapped read-only. MAP_SHARED: processes mapping the same
+// library share its pages.
+class MappedFile {
+public:
+  explicit MappedFile(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_ = static_cast<size_t>(st.st_size);
+      data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);  // the mapping keeps the file alive
+    if (data_ == MAP_FAILED || data_ == nullptr) {
+      throw std::runtime_error("cannot map " + path);
+    }
+  }
+
+  ~MappedFile() { ::munmap(data_, size_); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const void* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
 template<typename T>
 T Get(T t) {
   cout << "return: " << t << "\n";
@@ -296,5 +1327,192 @@ int main() {
   Node ret5 = GetReturnType(f7, args7);
   std::cout << ret5.ToString() << " (expected: (str, float))\n";
 
+  cout << "\n=== Hash-consed types ===\n";
+  TypeArena arena;
+  const Type* a1 = arena.FromNode(nested_node);
+  const Type* a2 = arena.FromNode(Node({T, Node({n_int, Node({U, n_str})})}));
+  cout << "same node = " << (a1 == a2) << " [EXPECTED: 1]\n";
+  cout << "types = " << arena.size() << " [EXPECTED: 7]\n";
+  cout << arena.ToString(a1) << " [EXPECTED: (T,(int,(U,str)))]\n";
+  // T -> float: the (int,(U,str)) subtree is shared, not rebuilt.
+  const Type* sub = arena.Substitute(a1, {{arena.Base("T"), arena.Base("float")}});
+  cout << arena.ToString(sub) << " [EXPECTED: (float,(int,(U,str)))]\n";
+  cout << "shared = " << (sub->elems[1] == a1->elems[1]) << " [EXPECTED: 1]\n";
+  Signature s7{{arena.FromNode(T), arena.FromNode(Node({U, V}))},
+               arena.FromNode(Node({U, V}))};
+  vector<const Type*> targs7 = {arena.FromNode(n_int),
+                                arena.FromNode(Node({n_str, n_float}))};
+  const Type* r7 = GetReturnType(arena, s7, targs7);
+  cout << arena.ToString(r7) << " [EXPECTED: (str,float)]\n";
+  cout << "reused arg = " << (r7 == targs7[1]) << " [EXPECTED: 1]\n";
+  Signature sm{{arena.Base("T"), arena.Base("T")},
+               arena.FromNode(Node({T, T}))};
+  vector<const Type*> mixed = {arena.Base("int"), arena.Base("str")};
+  cout << "ReturnType = " << (GetReturnType(arena, sm, mixed) ? "ok" : "invalid")
+       << " [EXPECTED: invalid]\n";
+
+  cout << "\n=== Unification ===\n";
+  Unifier unifier(arena);
+  auto show = [&](const Type* t) { return t ? arena.ToString(t) : string("invalid"); };
+  const Type *tT = arena.Base("T"), *tU = arena.Base("U"), *tX = arena.Base("X");
+  const Type *tint = arena.Base("int"), *tstr = arena.Base("str");
+  // (T, T) -> T with (X, int): T = X, then X = int.
+  Signature same{{tT, tT}, tT};
+  cout << show(InferReturnType(unifier, same, {tX, tint})) << " [EXPECTED: int]\n";
+  cout << show(GetReturnType(arena, same, {tX, tint})) << " [EXPECTED: invalid]\n";
+  // ((T, U), U) -> (U, T) with ((X, X), int): every variable ends up int.
+  Signature nested{{arena.Tuple({tT, tU}), tU}, arena.Tuple({tU, tT})};
+  cout << show(InferReturnType(unifier, nested, {arena.Tuple({tX, tX}), tint}))
+       << " [EXPECTED: (int,int)]\n";
+  // Generics on both sides of one tuple: (T, int) against (str, X).
+  Signature pair_sig{{arena.Tuple({tT, tint})}, arena.Tuple({tT, tT})};
+  cout << show(InferReturnType(unifier, pair_sig, {arena.Tuple({tstr, tX})}))
+       << " [EXPECTED: (str,str)]\n";
+  // Occurs-check: X = (X, int) has no finite solution.
+  cout << show(InferReturnType(unifier, same, {tX, arena.Tuple({tX, tint})}))
+       << " [EXPECTED: invalid]\n";
+  // The caller's own T is not the function's T.
+  Signature ident{{tT}, arena.Tuple({tT, tint})};
+  cout << show(InferReturnType(unifier, ident, {arena.Tuple({tT, tstr})}))
+       << " [EXPECTED: ((T,str),int)]\n";
+  // (T, V) -> T with (U, T): the result is the caller's U, not its T.
+  const Type* tV = arena.Base("V");
+  Signature first{{tT, tV}, tT};
+  cout << show(InferReturnType(unifier, first, {tU, tT})) << " [EXPECTED: U]\n";
+  // A function variable left free is renamed when the caller uses its name.
+  Signature widen{{tT}, arena.Tuple({tT, tV})};
+  cout << show(InferReturnType(unifier, widen, {tV})) << " [EXPECTED: (V,T1)]\n";
+  cout << show(InferReturnType(unifier, widen, {tint})) << " [EXPECTED: (int,V)]\n";
+
+  cout << "\n=== Instantiation cache ===\n";
+  InstantiationCache cache(arena);
+  vector<vector<const Type*>> calls = {
+      {tX, tint}, {tstr, tstr}, {tint, tstr}, {arena.Tuple({tint, tstr}), tX}};
+  vector<thread> workers;
+  for (int w = 0; w < 4; ++w) {
+    workers.emplace_back([&] {
+      for (int i = 0; i < 1000; ++i) {
+        cache.Get(same, calls[i % calls.size()]);
+      }
+    });
+  }
+  for (thread& w : workers) {
+    w.join();
+  }
+  InstantiationCache::Stats st = cache.stats();
+  cout << "entries = " << st.entries << " [EXPECTED: 4]\n";
+  cout << "misses = " << st.misses << " [EXPECTED: 4]\n";
+  cout << "hits = " << st.hits << " [EXPECTED: 3996]\n";
+  cout << show(cache.Get(same, {tX, tint})) << " [EXPECTED: int]\n";
+  cout << show(cache.Get(same, {tint, tstr})) << " [EXPECTED: invalid]\n";
+  cout << show(cache.Get(nested, {arena.Tuple({tX, tX}), tint}))
+       << " [EXPECTED: (int,int)]\n";
+  cout << "misses = " << cache.stats().misses << " [EXPECTED: 5]\n";
+  cout << show(cache.Get(first, {tU, tT})) << " [EXPECTED: U]\n";
+
+  cout << "\n=== Batch checking ===\n";
+  // Everything the calls mention is interned up front; the arena is then
+  // frozen while the batch runs.
+  const Type* tfloat = arena.Base("float");
+  vector<const Type*> prims = {tint, tstr, tfloat};
+  Signature swap{{arena.Tuple({tT, tU})}, arena.Tuple({tU, tT})};
+  vector<Call> module;
+  for (size_t i = 0; i < 100000; ++i) {
+    const Type* a = prims[i % 3];
+    const Type* b = prims[i / 3 % 3];
+    switch (i % 4) {
+      case 0: module.push_back({&swap, {arena.Tuple({a, b})}}); break;
+      case 1: module.push_back({&same, {a, b}}); break;
+      case 2: module.push_back({&same, {a}}); break;
+      case 3: module.push_back({&nested, {arena.Tuple({tX, tX}), a}}); break;
+    }
+  }
+  WorkerPool pool(4);
+  CheckBatchResult checked = CheckBatch(arena, module, pool);
+  size_t ok = 0, arity = 0, mismatch = 0, agree = 0;
+  for (size_t i = 0; i < module.size(); ++i) {
+    const CheckBatchResult::Result& r = checked.results[i];
+    ok += r.error == CheckBatchResult::Error::kNone;
+    arity += r.error == CheckBatchResult::Error::kArity;
+    mismatch += r.error == CheckBatchResult::Error::kMismatch;
+    const Type* want = InferReturnType(unifier, *module[i].func, module[i].args);
+    agree += show(r.ret) == show(want);
+  }
+  cout << "ok = " << ok << " [EXPECTED: 58334]\n";
+  cout << "arity = " << arity << " [EXPECTED: 25000]\n";
+  cout << "mismatch = " << mismatch << " [EXPECTED: 16666]\n";
+  cout << "agree = " << agree << " [EXPECTED: 100000]\n";
+  cout << "workers = " << checked.scratch.size() << " [EXPECTED: 4]\n";
+  // A second batch reuses the pool's threads.
+  size_t again = 0;
+  for (const auto& r : CheckBatch(arena, module, pool).results) {
+    again += r.error == CheckBatchResult::Error::kNone;
+  }
+  cout << "ok again = " << again << " [EXPECTED: 58334]\n";
+  cout << show(checked.results[0].ret) << " [EXPECTED: (int,int)]\n";
+  cout << show(checked.results[4].ret) << " [EXPECTED: (str,str)]\n";
+  cout << "failed arg = " << checked.results[5].arg << " [EXPECTED: 1]\n";
+
+  cout << "\n=== Binary encoding ===\n";
+  TypeEncoder encoder;
+  const Type* deep = arena.Tuple({tint, arena.Tuple({tstr, tT}), tX});
+  encoder.Add(deep);
+  encoder.Add(tint);
+  encoder.Add(arena.FromNode(Node({n_int, Node({n_str, U})})));
+  vector<const Type*> wide(100, tfloat);  // 100 elements: a varint count
+  encoder.Add(arena.Tuple(wide));
+  string lib_path = (std::filesystem::temp_directory_path() / "types.typ1").string();
+  encoder.WriteFile(lib_path);
+  {
+    MappedFile file(lib_path);
+    EncodedTypes lib(file.data(), file.size());
+    cout << "types = " << lib.size() << " [EXPECTED: 4]\n";
+    cout << lib[0].ToString() << " [EXPECTED: (int,(str,T),X)]\n";
+    cout << lib[2].ToString() << " [EXPECTED: (int,(str,U))]\n";
+    cout << "elems = " << lib[3].size() << " [EXPECTED: 100]\n";
+    cout << "wide = " << (lib.Load(arena, lib[3]) == arena.Tuple(wide)) << " [EXPECTED: 1]\n";
+    cout << "second = " << lib[0].Child().Next().ToString() << " [EXPECTED: (str,T)]\n";
+    cout << "same node = " << (lib.Load(arena, lib[0]) == deep) << " [EXPECTED: 1]\n";
+    // 80 bytes of header, tables and names; one tag byte per node, plus one
+    // varint byte for the 100-element tuple.
+    cout << "file bytes = " << file.size() << " [EXPECTED: 194]\n";
+  }
+  std::filesystem::remove(lib_path);
+  string corrupt = encoder.Finish();
+  corrupt.pop_back();
+  try {
+    EncodedTypes lib(corrupt.data(), corrupt.size());
+    cout << "loaded";
+  } catch (const std::runtime_error& e) {
+    cout << e.what();
+  }
+  cout << " [EXPECTED: corrupt type library]\n";
+  // Hand-made libraries: names "int", one root at offset 0 of `stream`.
+  auto library = [](const string& stream) {
+    string out(encoded::kMagic, 4);
+    for (uint32_t w : {1u, 1u, 4u, uint32_t(stream.size()), 0u, 3u, 0u}) {
+      out.append(reinterpret_cast<const char*>(&w), 4);
+    }
+    return out + string("int\0", 4) + stream;
+  };
+  // 2 MB of nested 1-tuples, then a tuple claiming 2^32 - 1 elements.
+  string nested_tags(2 << 20, char(encoded::kTuple | 1 << 2));
+  string huge_count = {char(encoded::kTuple | encoded::kInlineMax << 2),
+                       '\xff', '\xff', '\xff', '\xff', '\x0f'};
+  for (const string& stream : {nested_tags + '\0', huge_count}) {
+    string bytes = library(stream);
+    string what[2];
+    for (int load = 0; load < 2; ++load) {
+      try {
+        EncodedTypes lib(bytes.data(), bytes.size());
+        what[load] = load ? arena.ToString(lib.Load(arena, lib[0])) : lib[0].ToString();
+      } catch (const std::runtime_error& e) {
+        what[load] = e.what();
+      }
+    }
+    cout << what[0] << " | " << what[1]
+         << " [EXPECTED: corrupt type library | corrupt type library]\n";
+  }
+
   return 0;
 }